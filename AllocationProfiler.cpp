@@ -0,0 +1,155 @@
+#include "AllocationProfiler.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+AllocationProfiler::AllocationProfiler() {
+	reset();
+}
+
+void AllocationProfiler::reset() {
+	SizeStat empty = {};
+	for (size_t i = 0; i < PROFILE_NUM_BUCKETS; i++) {
+		buckets[i] = empty;
+	}
+	medium_stat = empty;
+	huge_stat = empty;
+	time = 0;
+	live.clear();
+}
+
+void AllocationProfiler::recordAlloc(size_t size, void* p) {
+	if (p == nullptr) {
+		return;
+	}
+
+	SizeStat& stat = statOf(size);
+	stat.count++;
+	stat.live++;
+	stat.live_bytes += size;
+	if (stat.live > stat.peak_live) {
+		stat.peak_live = stat.live;
+	}
+	if (stat.live_bytes > stat.peak_live_bytes) {
+		stat.peak_live_bytes = stat.live_bytes;
+	}
+	if (size > stat.max_size) {
+		stat.max_size = size;
+	}
+
+	LiveAlloc alloc;
+	alloc.size = size;
+	alloc.time = time++;
+	live[p] = alloc;
+}
+
+void AllocationProfiler::recordFree(void* p) {
+	auto it = live.find(p);
+	if (it == live.end()) {
+		return;
+	}
+
+	SizeStat& stat = statOf(it->second.size);
+	stat.live--;
+	stat.live_bytes -= it->second.size;
+	stat.total_lifetime += time - it->second.time;
+	stat.num_freed++;
+	live.erase(it);
+}
+
+const AllocationProfiler::SizeStat& AllocationProfiler::bucket(size_t i) const {
+	return buckets[i];
+}
+
+const AllocationProfiler::SizeStat& AllocationProfiler::medium() const {
+	return medium_stat;
+}
+
+const AllocationProfiler::SizeStat& AllocationProfiler::huge() const {
+	return huge_stat;
+}
+
+bool AllocationProfiler::save(const char* path) const {
+	std::ofstream out(path);
+	if (!out) {
+		return false;
+	}
+
+	for (size_t i = 0; i < PROFILE_NUM_BUCKETS; i++) {
+		if (buckets[i].count == 0) {
+			continue;
+		}
+		out << "bucket " << (i + 1) * PROFILE_GRANULARITY << " " << buckets[i].count << " " << buckets[i].peak_live
+			<< " " << buckets[i].total_lifetime << " " << buckets[i].num_freed << std::endl;
+	}
+	out << "medium " << medium_stat.count << " " << medium_stat.peak_live << " " << medium_stat.peak_live_bytes << " " << medium_stat.max_size
+		<< " " << medium_stat.total_lifetime << " " << medium_stat.num_freed << std::endl;
+	out << "huge " << huge_stat.count << " " << huge_stat.peak_live << " " << huge_stat.peak_live_bytes << " " << huge_stat.max_size
+		<< " " << huge_stat.total_lifetime << " " << huge_stat.num_freed << std::endl;
+	return static_cast<bool>(out);
+}
+
+bool AllocationProfiler::load(const char* path) {
+	std::ifstream in(path);
+	if (!in) {
+		return false;
+	}
+	reset();
+
+	std::string key;
+	while (in >> key) {
+		if (key == "bucket") {
+			size_t size;
+			in >> size;
+			if (!in || size == 0 || size > PROFILE_MAX_SMALL_SIZE || size % PROFILE_GRANULARITY != 0) {
+				return false;
+			}
+			SizeStat& stat = buckets[size / PROFILE_GRANULARITY - 1];
+			in >> stat.count >> stat.peak_live >> stat.total_lifetime >> stat.num_freed;
+			stat.max_size = size;
+			stat.peak_live_bytes = stat.peak_live * size;
+		}
+		else if (key == "medium" || key == "huge") {
+			SizeStat& stat = key == "medium" ? medium_stat : huge_stat;
+			in >> stat.count >> stat.peak_live >> stat.peak_live_bytes >> stat.max_size >> stat.total_lifetime >> stat.num_freed;
+		}
+		else {
+			return false;
+		}
+		if (!in) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void AllocationProfiler::dump() const {
+	std::cout << "Allocation Profile:" << std::endl;
+	for (size_t i = 0; i < PROFILE_NUM_BUCKETS; i++) {
+		const SizeStat& stat = buckets[i];
+		if (stat.count == 0) {
+			continue;
+		}
+		std::cout << "\tSize " << (i + 1) * PROFILE_GRANULARITY << " Allocs: " << stat.count << " Peak live: " << stat.peak_live;
+		if (stat.num_freed != 0) {
+			std::cout << " Mean lifetime: " << stat.total_lifetime / stat.num_freed;
+		}
+		std::cout << std::endl;
+	}
+	std::cout << "\tMedium Allocs: " << medium_stat.count << " Peak live bytes: " << medium_stat.peak_live_bytes
+		<< " Max size: " << medium_stat.max_size << std::endl;
+	std::cout << "\tHuge Allocs: " << huge_stat.count << " Peak live bytes: " << huge_stat.peak_live_bytes << std::endl;
+	std::cout << std::endl;
+}
+
+AllocationProfiler::SizeStat& AllocationProfiler::statOf(size_t size) {
+	if (size <= PROFILE_MAX_SMALL_SIZE) {
+		size_t index = size == 0 ? 0 : (size - 1) / PROFILE_GRANULARITY;
+		return buckets[index];
+	}
+	if (size < SIZE) {
+		return medium_stat;
+	}
+	return huge_stat;
+}
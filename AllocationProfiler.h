@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <unordered_map>
+
+#include "AllocatorConfig.h"
+
+#define PROFILE_GRANULARITY 16
+#define PROFILE_MAX_SMALL_SIZE 1024
+#define PROFILE_NUM_BUCKETS (PROFILE_MAX_SMALL_SIZE / PROFILE_GRANULARITY)
+
+// Collects the size histogram and lifetimes of a run. Lifetimes are counted
+// in allocations made in between, so they do not depend on timing noise.
+// Small sizes are kept per PROFILE_GRANULARITY bucket, sizes up to SIZE
+// (the coalescer's range) and above are summed up.
+class AllocationProfiler {
+public:
+	struct SizeStat {
+		size_t count;
+		size_t live;
+		size_t peak_live;
+		size_t live_bytes;
+		size_t peak_live_bytes;
+		size_t max_size;
+		unsigned long long total_lifetime;
+		size_t num_freed;
+	};
+
+	AllocationProfiler();
+
+	void reset();
+	void recordAlloc(size_t size, void* p);
+	void recordFree(void* p);
+
+	// Bucket i holds sizes in (i * PROFILE_GRANULARITY, (i + 1) * PROFILE_GRANULARITY].
+	const SizeStat& bucket(size_t i) const;
+	const SizeStat& medium() const;
+	const SizeStat& huge() const;
+
+	// Text format, one line per non empty bucket:
+	//	bucket <size> <count> <peak live> <total lifetime> <freed>
+	//	medium <count> <peak live> <peak live bytes> <max size> <total lifetime> <freed>
+	//	huge <count> <peak live> <peak live bytes> <max size> <total lifetime> <freed>
+	bool save(const char* path) const;
+	bool load(const char* path);
+	void dump() const;
+
+private:
+	struct LiveAlloc {
+		size_t size;
+		unsigned long long time;
+	};
+
+	SizeStat& statOf(size_t size);
+
+	SizeStat buckets[PROFILE_NUM_BUCKETS];
+	SizeStat medium_stat;
+	SizeStat huge_stat;
+
+	unsigned long long time;
+	std::unordered_map<void*, LiveAlloc> live;
+};
@@ -0,0 +1,78 @@
+#include "AllocatorConfig.h"
+
+#include <fstream>
+#include <string>
+
+AllocatorConfig defaultAllocatorConfig() {
+	AllocatorConfig config;
+	config.num_classes = 6;
+	size_t block_size = 16;
+	size_t blocks_per_page = 512;
+	for (size_t i = 0; i < config.num_classes; i++) {
+		config.class_size[i] = block_size;
+		config.blocks_per_page[i] = blocks_per_page;
+		block_size *= 2;
+		blocks_per_page /= 2;
+	}
+	config.coalesce_size = SIZE * 2;
+	return config;
+}
+
+bool loadAllocatorConfig(const char* path, AllocatorConfig& config) {
+	std::ifstream in(path);
+	if (!in) {
+		return false;
+	}
+
+	AllocatorConfig loaded;
+	loaded.num_classes = 0;
+	loaded.coalesce_size = 0;
+
+	std::string key;
+	while (in >> key) {
+		if (key == "coalesce_size") {
+			in >> loaded.coalesce_size;
+		}
+		else if (key == "class") {
+			if (loaded.num_classes == MAX_FSA) {
+				return false;
+			}
+			in >> loaded.class_size[loaded.num_classes] >> loaded.blocks_per_page[loaded.num_classes];
+			loaded.num_classes++;
+		}
+		else {
+			return false;
+		}
+		if (!in) {
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < loaded.num_classes; i++) {
+		if (loaded.class_size[i] == 0 || loaded.class_size[i] % CLASS_ALIGNMENT != 0 || loaded.blocks_per_page[i] == 0) {
+			return false;
+		}
+		if (i > 0 && loaded.class_size[i] <= loaded.class_size[i - 1]) {
+			return false;
+		}
+	}
+	if (loaded.coalesce_size == 0) {
+		return false;
+	}
+
+	config = loaded;
+	return true;
+}
+
+bool saveAllocatorConfig(const char* path, const AllocatorConfig& config) {
+	std::ofstream out(path);
+	if (!out) {
+		return false;
+	}
+
+	out << "coalesce_size " << config.coalesce_size << std::endl;
+	for (size_t i = 0; i < config.num_classes; i++) {
+		out << "class " << config.class_size[i] << " " << config.blocks_per_page[i] << std::endl;
+	}
+	return static_cast<bool>(out);
+}
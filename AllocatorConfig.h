@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+
+// Allocations of at least SIZE bytes bypass the pools and go to the OS.
+#define SIZE 10485760
+#define MAX_FSA 16
+// Pool blocks keep the alignment the coalescer and MemoryResource promise
+// (COALESCE_ALIGNMENT, MEMORY_RESOURCE_ALIGNMENT), so class sizes are multiples of it.
+#define CLASS_ALIGNMENT 16
+
+// Size classes and pool sizes MemoryAllocator::init sets up. Classes are
+// sorted by size, sizes above the last class go to the coalescer.
+struct AllocatorConfig {
+	size_t num_classes;
+	size_t class_size[MAX_FSA];
+	size_t blocks_per_page[MAX_FSA];
+	size_t coalesce_size;
+};
+
+// The classes MemoryAllocator always used: 16 ... 512 bytes and a 20 MB coalescer buffer.
+AllocatorConfig defaultAllocatorConfig();
+
+// Text format, one entry per line:
+//	coalesce_size <bytes>
+//	class <block size> <blocks per page>
+bool loadAllocatorConfig(const char* path, AllocatorConfig& config);
+bool saveAllocatorConfig(const char* path, const AllocatorConfig& config);
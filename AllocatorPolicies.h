@@ -0,0 +1,270 @@
+#pragma once
+#include <cassert>
+#include <windows.h>
+
+#include <vector>
+
+#include "AllocatorConfig.h"
+#include "CoalesceAllocator.h"
+
+// Header-only building blocks for assembling allocators at compile time.
+// Every policy has the same non-virtual interface:
+//
+//	void init();
+//	void destroy();
+//	void* alloc(size_t size);   // nullptr when the policy can not serve size
+//	bool free(void* p);         // false when p does not belong to the policy
+//	bool owns(const void* p) const;
+//
+// so the whole stack is resolved and inlined by the compiler.
+
+// Blocks straight from the OS. The static allocatePages/releasePages are the
+// page source of the pools, an OsBackend instance is the last resort of a
+// stack: it tracks its blocks like MemoryAllocator's OSBlocks and releases
+// the ones still outstanding in destroy.
+class OsBackend {
+public:
+	static void* allocatePages(size_t size) {
+		return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	}
+	static void releasePages(void* p, size_t) {
+		VirtualFree(p, 0, MEM_RELEASE);
+	}
+
+	void init() {}
+	void destroy() {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			releasePages(blocks[i], 0);
+		}
+		blocks.clear();
+	}
+
+	void* alloc(size_t size) {
+		void* p = allocatePages(size);
+		if (p != nullptr) {
+			blocks.push_back(p);
+		}
+		return p;
+	}
+	bool free(void* p) {
+		for (auto it = blocks.begin(); it < blocks.end(); it++) {
+			if (*it == p) {
+				blocks.erase(it);
+				releasePages(p, 0);
+				return true;
+			}
+		}
+		return false;
+	}
+	bool owns(const void* p) const {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			if (blocks[i] == p) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<void*> blocks;
+};
+
+// A separate, header-only implementation of FixedSizeAllocator's algorithm
+// (pages with an index free list and lazily initialized blocks), so it can be
+// inlined. It has none of FixedSizeAllocator's real-time, shared or persistent
+// modes. MaxPages == 0 lets the pool grow without bound, otherwise alloc fails
+// once MaxPages are full.
+template <size_t BlockSize, size_t BlocksPerPage, size_t MaxPages = 0, class Backend = OsBackend>
+class FixedPool {
+public:
+	void init() {
+		page = nullptr;
+		num_pages = 0;
+		allocPage(page);
+	}
+	void destroy() {
+		while (page != nullptr) {
+			Page* next = page->next;
+			Backend::releasePages(page, PAGE_ALLOC_SIZE);
+			page = next;
+		}
+	}
+
+	void* alloc(size_t size) {
+		if (size > BlockSize) {
+			return nullptr;
+		}
+
+		Page* current_page = page;
+		while (current_page->fh == INDEX_END_OF_LIST) {
+			if (current_page->num_initialized < BlocksPerPage) {
+				current_page->num_initialized++;
+				return static_cast<char*>(current_page->blocks) + (current_page->num_initialized - 1) * BlockSize;
+			}
+			if (current_page->next == nullptr) {
+				if (MaxPages != 0 && num_pages == MaxPages) {
+					return nullptr;
+				}
+				allocPage(current_page->next);
+			}
+			current_page = current_page->next;
+		}
+		void* p = static_cast<char*>(current_page->blocks) + current_page->fh * BlockSize;
+		current_page->fh = *static_cast<size_t*>(p);
+		return p;
+	}
+
+	bool free(void* p) {
+		Page* current_page = ownerPage(p);
+		if (current_page == nullptr) {
+			return false;
+		}
+		*static_cast<size_t*>(p) = current_page->fh;
+		current_page->fh = static_cast<size_t>((static_cast<char*>(p) - static_cast<char*>(current_page->blocks)) / BlockSize);
+		return true;
+	}
+
+	bool owns(const void* p) const {
+		return ownerPage(p) != nullptr;
+	}
+
+private:
+	static_assert(BlockSize >= sizeof(size_t), "FixedPool: block can not hold the free list index");
+
+	struct Page {
+		Page* next;
+		size_t fh;
+		size_t num_initialized;
+		void* blocks;
+	};
+
+	static const size_t PAGE_ALLOC_SIZE = BlockSize * BlocksPerPage + sizeof(Page);
+
+	void allocPage(Page*& new_page) {
+		void* buf = Backend::allocatePages(PAGE_ALLOC_SIZE);
+		new_page = static_cast<Page*>(buf);
+		new_page->next = nullptr;
+		new_page->fh = INDEX_END_OF_LIST;
+		new_page->blocks = static_cast<char*>(buf) + sizeof(Page);
+		new_page->num_initialized = 0;
+		num_pages++;
+	}
+
+	Page* ownerPage(const void* p) const {
+		Page* current_page = page;
+		while (current_page != nullptr) {
+			if (current_page->blocks <= p && static_cast<char*>(current_page->blocks) + BlocksPerPage * BlockSize > p) {
+				return current_page;
+			}
+			current_page = current_page->next;
+		}
+		return nullptr;
+	}
+
+	Page* page;
+	size_t num_pages;
+};
+
+// Adapts CoalesceAllocator to the policy interface. Medium sizes are not on
+// the inlined fast path, so the out-of-line implementation is reused as is.
+template <size_t BufferSize>
+class CoalescePool {
+public:
+	void init() {
+		coalesce_alloc.init(BufferSize);
+	}
+	void destroy() {
+		coalesce_alloc.destroy();
+	}
+
+	void* alloc(size_t size) {
+		return coalesce_alloc.alloc(size);
+	}
+	bool free(void* p) {
+		return coalesce_alloc.free(p);
+	}
+	bool owns(const void* p) const {
+		return coalesce_alloc.owns(p);
+	}
+
+private:
+	CoalesceAllocator coalesce_alloc;
+};
+
+// Sizes up to Threshold go to Small, everything else to Large.
+template <size_t Threshold, class Small, class Large>
+class Segregator {
+public:
+	void init() {
+		small.init();
+		large.init();
+	}
+	void destroy() {
+		small.destroy();
+		large.destroy();
+	}
+
+	void* alloc(size_t size) {
+		if (size <= Threshold) {
+			return small.alloc(size);
+		}
+		return large.alloc(size);
+	}
+	bool free(void* p) {
+		if (small.owns(p)) {
+			return small.free(p);
+		}
+		return large.free(p);
+	}
+	bool owns(const void* p) const {
+		return small.owns(p) || large.owns(p);
+	}
+
+private:
+	Small small;
+	Large large;
+};
+
+// Tries Primary first and falls back to Secondary when Primary is full.
+template <class Primary, class Secondary>
+class Fallback {
+public:
+	void init() {
+		primary.init();
+		secondary.init();
+	}
+	void destroy() {
+		primary.destroy();
+		secondary.destroy();
+	}
+
+	void* alloc(size_t size) {
+		void* p = primary.alloc(size);
+		if (p != nullptr) {
+			return p;
+		}
+		return secondary.alloc(size);
+	}
+	bool free(void* p) {
+		if (primary.owns(p)) {
+			return primary.free(p);
+		}
+		return secondary.free(p);
+	}
+	bool owns(const void* p) const {
+		return primary.owns(p) || secondary.owns(p);
+	}
+
+private:
+	Primary primary;
+	Secondary secondary;
+};
+
+// The stack MemoryAllocator is built from by default, assembled from policies.
+typedef Segregator<16, FixedPool<16, 512>,
+	Segregator<32, FixedPool<32, 256>,
+	Segregator<64, FixedPool<64, 128>,
+	Segregator<128, FixedPool<128, 64>,
+	Segregator<256, FixedPool<256, 32>,
+	Segregator<512, FixedPool<512, 16>,
+	Segregator<SIZE - 1, CoalescePool<SIZE * 2>, OsBackend> > > > > > > DefaultPolicyAllocator;
@@ -0,0 +1,36 @@
+#include <iostream>
+
+#include "AllocationProfiler.h"
+#include "AllocatorConfig.h"
+#include "SizeClassTuner.h"
+
+// Turns a profile saved by AllocationProfiler::save into a configuration
+// for MemoryAllocator::init (see loadAllocatorConfig).
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        std::cout << "Usage: AllocatorTune <profile> <config>" << std::endl;
+        return 1;
+    }
+
+    AllocationProfiler profile;
+    if (!profile.load(argv[1])) {
+        std::cout << "Can not read profile " << argv[1] << std::endl;
+        return 1;
+    }
+    profile.dump();
+
+    AllocatorConfig config = tuneAllocatorConfig(profile);
+
+    std::cout << "Allocator Config:" << std::endl;
+    for (size_t i = 0; i < config.num_classes; i++) {
+        std::cout << "\tClass " << config.class_size[i] << " Blocks per page: " << config.blocks_per_page[i] << std::endl;
+    }
+    std::cout << "\tCoalesce buffer: " << config.coalesce_size << std::endl;
+
+    if (!saveAllocatorConfig(argv[2], config)) {
+        std::cout << "Can not write config " << argv[2] << std::endl;
+        return 1;
+    }
+    return 0;
+}
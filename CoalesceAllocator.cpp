@@ -1,6 +1,8 @@
 #include "CoalesceAllocator.h"
 
 CoalesceAllocator::CoalesceAllocator() {
+    free_handle = INDEX_END_OF_LIST;
+    compact_buff = nullptr;
 #ifdef _DEBUG
     is_initialized = false;
     is_destroyed = false;
@@ -23,10 +25,149 @@ void CoalesceAllocator::init(size_t OSBlockSize) {
     is_destroyed = false;
 #endif 
 
-    this->buffer_size = OSBlockSize;
+    this->buffer_size = (OSBlockSize + COALESCE_ALIGNMENT - 1) & ~static_cast<size_t>(COALESCE_ALIGNMENT - 1);
+    this->is_fixed = false;
+    this->is_real_time = false;
+    this->use_quick_lists = true;
+    this->is_shared = false;
+    this->is_persistent = false;
     allocBuffer(buffer);
 }
 
+void CoalesceAllocator::initRealTime(size_t OSBlockSize) {
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "CoalesceAllocator: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->buffer_size = (OSBlockSize + COALESCE_ALIGNMENT - 1) & ~static_cast<size_t>(COALESCE_ALIGNMENT - 1);
+    this->is_fixed = true;
+    this->is_real_time = true;
+    this->use_quick_lists = false;
+    this->is_shared = false;
+    this->is_persistent = false;
+    allocBuffer(buffer);
+}
+
+bool CoalesceAllocator::initShared(const char* name, size_t OSBlockSize) {
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "CoalesceAllocator: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->buffer_size = (OSBlockSize + COALESCE_ALIGNMENT - 1) & ~static_cast<size_t>(COALESCE_ALIGNMENT - 1);
+    this->is_fixed = true;
+    this->is_real_time = false;
+    this->use_quick_lists = true;
+    this->is_shared = true;
+    this->is_persistent = false;
+
+    void* buf = createSharedSegment(name, headerSize() + buffer_size + sizeof(Block), mapping);
+    if (buf == nullptr) {
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    buffer = formatBuffer(buf);
+    return true;
+}
+
+bool CoalesceAllocator::openShared(const char* name) {
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "CoalesceAllocator: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->is_fixed = true;
+    this->is_real_time = false;
+    this->use_quick_lists = true;
+    this->is_shared = true;
+    this->is_persistent = false;
+
+    void* buf = openSharedSegment(name, mapping);
+    if (buf == nullptr) {
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    buffer = static_cast<Buffer*>(buf);
+    if (buffer->magic != COALESCE_HEAP_MAGIC || buffer->layout != heapLayout()) {
+        closeSharedSegment(buf, mapping);
+        buffer = nullptr;
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    this->buffer_size = buffer->buffer_size;
+    return true;
+}
+
+bool CoalesceAllocator::initPersistent(const char* path, size_t OSBlockSize, bool& resumed) {
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "CoalesceAllocator: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->buffer_size = (OSBlockSize + COALESCE_ALIGNMENT - 1) & ~static_cast<size_t>(COALESCE_ALIGNMENT - 1);
+    this->is_fixed = true;
+    this->is_real_time = false;
+    this->use_quick_lists = true;
+    this->is_shared = false;
+    this->is_persistent = true;
+
+    bool existed;
+    void* buf = openFileSegment(path, headerSize() + buffer_size + sizeof(Block), file, mapping, existed);
+    if (buf == nullptr) {
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    buffer = static_cast<Buffer*>(buf);
+
+    resumed = existed && buffer->magic == COALESCE_HEAP_MAGIC && buffer->layout == heapLayout() && buffer->buffer_size == buffer_size && buffer->clean;
+    if (!resumed) {
+        formatBuffer(buf);
+        flush();
+        return true;
+    }
+
+    // The handle table of the process that wrote the heap is gone, so the
+    // resumed blocks are plain ones. Redone on every resume, the heap stays clean.
+    Block* current_block = static_cast<Block*>(blocksOf(buffer));
+    while (current_block != nullptr) {
+        current_block->handle = INDEX_END_OF_LIST;
+        current_block = nextBlock(buffer, current_block);
+    }
+    return true;
+}
+
+void CoalesceAllocator::flush() {
+    assert(is_persistent && "CoalesceAllocator: flush of a non persistent heap");
+    // The blocks reach the disk before the mark, so a clean heap is complete.
+    flushFileSegment(buffer, headerSize() + buffer_size + sizeof(Block), file);
+    buffer->clean = 1;
+    flushFileSegment(buffer, headerSize(), file);
+}
+
+void CoalesceAllocator::markDirty() {
+    if (is_persistent && buffer->clean) {
+        buffer->clean = 0;
+        flushFileSegment(buffer, headerSize(), file);
+    }
+}
+
 void CoalesceAllocator::destroy() {
 #ifdef _DEBUG
     assert(is_initialized && "CoalesceAllocator: not initialized before destroy");
@@ -34,7 +175,21 @@ void CoalesceAllocator::destroy() {
     is_initialized = false;
 #endif 
 
-    destroyBuffer(buffer);
+    if (is_shared) {
+        closeSharedSegment(buffer, mapping);
+    }
+    else if (is_persistent) {
+        flush();
+        closeFileSegment(buffer, mapping, file);
+    }
+    else {
+        destroyBuffer(buffer);
+    }
+    buffer = nullptr;
+
+    handles.clear();
+    free_handle = INDEX_END_OF_LIST;
+    compact_buff = nullptr;
 }
 
 void* CoalesceAllocator::alloc(size_t size) {
@@ -43,57 +198,32 @@ void* CoalesceAllocator::alloc(size_t size) {
     num_alloc++;
 #endif 
 
+    size = (size + COALESCE_ALIGNMENT - 1) & ~static_cast<size_t>(COALESCE_ALIGNMENT - 1);
+    if (size < sizeof(FreeLinks)) {
+        size = sizeof(FreeLinks);
+    }
+    markDirty();
+
     Buffer* current_buff = buffer;
     while (true) {
-
-        if (current_buff->fh != INDEX_END_OF_LIST) {
-
-            Block* current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_buff->blocks) + current_buff->fh));
-            Block* prev_block = nullptr;
-            size_t free_list_index;
-
-            while (true) {
-                free_list_index = *static_cast<size_t*>(current_block->data);
-                if (current_block->size >= size) {
-
-                    if (current_block->size == size) {
-                        if (prev_block == nullptr) {
-                            current_buff->fh = free_list_index;
-                        }
-                        else {
-                            *static_cast<size_t*>(prev_block->data) = INDEX_END_OF_LIST;
-                        }
-                        current_block->free = false;
-                        return current_block->data;
-                    }
-
-                    size_t old_size = current_block->size;
-                    current_block->size = size;
-                    Block* new_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_block->data) + size));
-                    new_block->data = static_cast<char*>(static_cast<void*>(new_block)) + sizeof(Block);
-                    new_block->size = old_size - size - sizeof(Block);
-                    new_block->free = true;
-                    *static_cast<size_t*>(new_block->data) = INDEX_END_OF_LIST;
-                    if (prev_block == nullptr) {
-                        current_buff->fh = static_cast<char*>(static_cast<void*>(new_block)) - static_cast<char*>(current_buff->blocks);
-                    }
-                    else {
-                        *static_cast<size_t*>(prev_block->data) = static_cast<char*>(static_cast<void*>(new_block)) - static_cast<char*>(current_buff->blocks);
-                    }
-                    current_block->free = false;
-                    return current_block->data;
-                }
-
-                if (free_list_index == INDEX_END_OF_LIST) {
-                    break;
-                }
-
-                prev_block = current_block;
-                current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_buff->blocks) + free_list_index));
-            }
+        if (is_shared) {
+            acquireSharedLock(&current_buff->lock);
+        }
+        void* p = allocFromBuffer(current_buff, size);
+        if (is_shared) {
+            releaseSharedLock(&current_buff->lock);
+        }
+        if (p != nullptr) {
+            return p;
         }
-    
+
         if (current_buff->next == nullptr) {
+            if (is_fixed || size > buffer_size) {
+#ifdef _DEBUG
+                num_alloc--;
+#endif 
+                return nullptr;
+            }
             allocBuffer(current_buff->next);
         }
         current_buff = current_buff->next;
@@ -107,60 +237,151 @@ bool CoalesceAllocator::free(void* p) {
     num_free++;
 #endif 
 
+    markDirty();
     Buffer* current_buff = buffer;
     while (current_buff != nullptr) {
 
-        if (current_buff->blocks < p && (char*)current_buff->blocks + buffer_size + sizeof(Block) > p) {
-            Block* current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_buff->blocks)));
-            Block* prev_block = nullptr;
-
-            while (current_block->data < p) {
-                prev_block = current_block;
-                current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_block->data) + current_block->size));
+        if (owns(current_buff, p)) {
+            if (is_shared) {
+                acquireSharedLock(&current_buff->lock);
+            }
+            freeInBuffer(current_buff, p);
+            if (is_shared) {
+                releaseSharedLock(&current_buff->lock);
             }
+            return true;
+        }
+        current_buff = current_buff->next;
+    }
 
-            Block* next_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_block->data) + current_block->size));
+#ifdef _DEBUG
+    num_free--;
+#endif 
+    return false;
+}
 
-            if (static_cast<void*>(next_block) >= (char*)current_buff->blocks + buffer_size + sizeof(Block)) {
-                next_block = nullptr;
-            }
+size_t CoalesceAllocator::toOffset(const void* p) const {
+    return static_cast<const char*>(p) - static_cast<const char*>(static_cast<const void*>(buffer));
+}
 
-            if (next_block != nullptr && next_block->free) {
-                size_t next_block_fl_index = current_buff->fh;
-                size_t prev_fl_index = INDEX_END_OF_LIST;
-                while (static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_buff->blocks) + next_block_fl_index)) != next_block) {
-                    prev_fl_index = next_block_fl_index;
-                    next_block_fl_index = *static_cast<size_t*>(static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_buff->blocks) + next_block_fl_index))->data);
-                }
-
-                if (prev_fl_index == INDEX_END_OF_LIST) { 
-                    current_buff->fh = *static_cast<size_t*>(next_block->data);
-                }
-                else {
-                    *static_cast<size_t*>(static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_buff->blocks) + prev_fl_index))->data) =
-                        *static_cast<size_t*>(next_block->data);;
-                }
-
-                current_block->size += next_block->size + sizeof(Block);
-            }
+void* CoalesceAllocator::fromOffset(size_t offset) const {
+    return static_cast<char*>(static_cast<void*>(buffer)) + offset;
+}
+
+size_t CoalesceAllocator::allocHandle(size_t size) {
+    assert(!is_shared && "CoalesceAllocator: handles are not available in shared mode");
+
+    void* p = alloc(size);
+    if (p == nullptr) {
+        return INDEX_END_OF_LIST;
+    }
+
+    size_t handle = free_handle;
+    if (handle != INDEX_END_OF_LIST) {
+        free_handle = handles[handle].pins;
+    }
+    else {
+        handle = handles.size();
+        handles.push_back(HandleEntry());
+    }
+    handles[handle].p = p;
+    handles[handle].pins = 0;
+
+    static_cast<Block*>(static_cast<void*>(static_cast<char*>(p) - sizeof(Block)))->handle = handle;
+    return handle;
+}
+
+void* CoalesceAllocator::pin(size_t handle) {
+    assert(handle < handles.size() && handles[handle].p != nullptr && "CoalesceAllocator: invalid handle");
+    handles[handle].pins++;
+    return handles[handle].p;
+}
+
+void CoalesceAllocator::unpin(size_t handle) {
+    assert(handle < handles.size() && handles[handle].p != nullptr && handles[handle].pins > 0 && "CoalesceAllocator: unpin without pin");
+    handles[handle].pins--;
+}
+
+void CoalesceAllocator::freeHandle(size_t handle) {
+    assert(handle < handles.size() && handles[handle].p != nullptr && "CoalesceAllocator: invalid handle");
+    assert(handles[handle].pins == 0 && "CoalesceAllocator: free of a pinned handle");
+
+    void* p = handles[handle].p;
+    static_cast<Block*>(static_cast<void*>(static_cast<char*>(p) - sizeof(Block)))->handle = INDEX_END_OF_LIST;
+    free(p);
+
+    handles[handle].p = nullptr;
+    handles[handle].pins = free_handle;
+    free_handle = handle;
+}
 
-            if (prev_block != nullptr && prev_block->free) {
-                prev_block->size += current_block->size + sizeof(Block);
-                return true;
+size_t CoalesceAllocator::compact(size_t max_moves) {
+    assert(!is_shared && "CoalesceAllocator: compaction is not available in shared mode");
+    markDirty();
+
+    if (compact_buff == nullptr) {
+        startCompactPass(buffer, false);
+    }
+
+    size_t moves = 0;
+    size_t visits = max_moves * COMPACT_VISITS_PER_MOVE;
+    while (moves < max_moves && visits > 0) {
+        visits--;
+        Block* current_block = blockAt(compact_buff, compact_offset);
+        Block* next_block = nextBlock(compact_buff, current_block);
+        if (!compact_evacuate) {
+            if (current_block->free && next_block != nullptr && isMovable(next_block)) {
+                current_block = moveDown(compact_buff, current_block, next_block);
+                compact_offset = offsetOf(compact_buff, current_block);
+                moves++;
+                continue;
             }
+        }
+        else if (isMovable(current_block)) {
+            Block* hole = evacuateBlock(compact_buff, current_block);
+            if (hole != nullptr) {
+                next_block = nextBlock(compact_buff, hole);
+                moves++;
+            }
+        }
 
-            current_block->free = true;
-            *static_cast<size_t*>(current_block->data) = current_buff->fh;
-            current_buff->fh = static_cast<char*>(static_cast<void*>(current_block)) - static_cast<char*>(current_buff->blocks);
-            
+        // Slide every buffer, then evacuate every buffer but the first one,
+        // then start over.
+        if (next_block != nullptr) {
+            compact_offset = offsetOf(compact_buff, next_block);
+        }
+        else if (compact_buff->next != nullptr) {
+            startCompactPass(compact_buff->next, compact_evacuate);
+        }
+        else if (!compact_evacuate && buffer->next != nullptr) {
+            startCompactPass(buffer->next, true);
+        }
+        else {
+            startCompactPass(buffer, false);
+        }
+    }
+
+    releaseEmptyBuffers();
+    return moves;
+}
+
+void CoalesceAllocator::setRoot(void* p) {
+    markDirty();
+    buffer->root = p == nullptr ? INDEX_END_OF_LIST : toOffset(p);
+}
+
+void* CoalesceAllocator::getRoot() const {
+    return buffer->root == INDEX_END_OF_LIST ? nullptr : fromOffset(buffer->root);
+}
+
+bool CoalesceAllocator::owns(const void* p) const {
+    Buffer* current_buff = buffer;
+    while (current_buff != nullptr) {
+        if (owns(current_buff, p)) {
             return true;
         }
         current_buff = current_buff->next;
     }
-
-#ifdef _DEBUG
-    num_free--;
-#endif 
     return false;
 }
 
@@ -173,32 +394,36 @@ void CoalesceAllocator::dumpStat() const {
 
     Buffer* current_buff = buffer;
     size_t busy_blocks = 0;
+    size_t quick_blocks = 0;
     size_t free_blocks = 0;
 
     while (current_buff != nullptr) {
-        Block* current_block = static_cast<Block*>(current_buff->blocks);
-        while (static_cast<char*>(static_cast<void*>(current_block)) - static_cast<char*>(current_buff->blocks) < buffer_size + sizeof(Block)) {
+        Block* current_block = static_cast<Block*>(blocksOf(current_buff));
+        while (static_cast<char*>(static_cast<void*>(current_block)) - static_cast<char*>(blocksOf(current_buff)) < buffer_size + sizeof(Block)) {
             
             if (current_block->free) {
                 free_blocks++;
             }
+            else if (current_block->quick) {
+                quick_blocks++;
+            }
             else {
                 busy_blocks++;
             }
 
-            current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_block->data) + current_block->size));
+            current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(dataOf(current_block)) + current_block->size));
         }
         current_buff = current_buff->next;
     }
 
-    std::cout << "\t\tBusy Blocks: " << busy_blocks << " Free Blocks: " << free_blocks << std::endl;
+    std::cout << "\t\tBusy Blocks: " << busy_blocks << " Quick Blocks: " << quick_blocks << " Free Blocks: " << free_blocks << std::endl;
 
     std::cout << "\t\tOS Buffers:" << std::endl;
     current_buff = buffer;
     size_t buffer_index = 0;
     while (current_buff != nullptr) {
         std::cout << "\t\t\tBuffer " << buffer_index << " Adress: " << static_cast<void*>(current_buff) 
-            << " Size: " << buffer_size + sizeof(Buffer) + sizeof(Block) << std::endl;
+            << " Size: " << buffer_size + headerSize() + sizeof(Block) << std::endl;
         buffer_index++;
         current_buff = current_buff->next;
     }
@@ -215,14 +440,17 @@ void CoalesceAllocator::dumpBlocks() const {
 
     while (current_buff != nullptr) {
         std::cout << "\t\tBuffer " << buffer_index << std::endl;
-        Block* current_block = static_cast<Block*>(current_buff->blocks);
+        Block* current_block = static_cast<Block*>(blocksOf(current_buff));
         size_t block_index = 0;
-        while (static_cast<char*>(static_cast<void*>(current_block)) - static_cast<char*>(current_buff->blocks) < buffer_size + sizeof(Block)) {
+        while (static_cast<char*>(static_cast<void*>(current_block)) - static_cast<char*>(blocksOf(current_buff)) < buffer_size + sizeof(Block)) {
 
             std::cout << "\t\t\tBlock " << block_index;
             if (current_block->free) {
                 std::cout << " Free";
             }
+            else if (current_block->quick) {
+                std::cout << " Quick";
+            }
             else {
                 std::cout << " Busy";
             }
@@ -231,7 +459,7 @@ void CoalesceAllocator::dumpBlocks() const {
 
             std::cout << " Adress: " << static_cast<void*>(current_block) << " Size " << current_block->size << std::endl;
 
-            current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(current_block->data) + current_block->size));
+            current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(dataOf(current_block)) + current_block->size));
         }
         current_buff = current_buff->next;
         buffer_index++;
@@ -241,16 +469,43 @@ void CoalesceAllocator::dumpBlocks() const {
 
 void CoalesceAllocator::allocBuffer(Buffer*& buffer)
 {
-    void* buf = VirtualAlloc(NULL, buffer_size + sizeof(Buffer) + sizeof(Block), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-    buffer = static_cast<Buffer*>(buf);
-    buffer->next = nullptr;
-    buffer->fh = 0;
-    buffer->blocks = static_cast<char*>(buf) + sizeof(Buffer);
-    Block* b = static_cast<Block*>(buffer->blocks);
+    void* buf = VirtualAlloc(NULL, headerSize() + buffer_size + sizeof(Block), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (is_fixed) {
+        prefaultPages(buf, headerSize() + buffer_size + sizeof(Block));
+    }
+    buffer = formatBuffer(buf);
+}
+
+CoalesceAllocator::Buffer* CoalesceAllocator::formatBuffer(void* buf)
+{
+    Buffer* new_buffer = static_cast<Buffer*>(buf);
+    new_buffer->next = nullptr;
+    new_buffer->magic = COALESCE_HEAP_MAGIC;
+    new_buffer->layout = heapLayout();
+    new_buffer->buffer_size = buffer_size;
+    new_buffer->root = INDEX_END_OF_LIST;
+    new_buffer->lock = 0;
+    new_buffer->clean = 0;
+    new_buffer->free_lists_mask = 0;
+    for (size_t i = 0; i < NUM_FREE_LISTS; i++) {
+        new_buffer->sub_lists_mask[i] = 0;
+        for (size_t j = 0; j < NUM_SUB_LISTS; j++) {
+            new_buffer->fh[i][j] = INDEX_END_OF_LIST;
+        }
+    }
+    new_buffer->num_quick = 0;
+    for (size_t i = 0; i < NUM_QUICK_LISTS; i++) {
+        new_buffer->quick_fh[i] = INDEX_END_OF_LIST;
+        new_buffer->quick_count[i] = 0;
+    }
+    Block* b = static_cast<Block*>(blocksOf(new_buffer));
     b->size = buffer_size;
-    b->data = static_cast<char*>(static_cast<void*>(b)) + sizeof(Block);
-    b->free = true;
-    *static_cast<size_t*>(b->data) = INDEX_END_OF_LIST;
+    b->prev = INDEX_END_OF_LIST;
+    b->free = false;
+    b->quick = false;
+    b->handle = INDEX_END_OF_LIST;
+    insertFree(new_buffer, b);
+    return new_buffer;
 }
 
 void CoalesceAllocator::destroyBuffer(Buffer*& buffer)
@@ -260,4 +515,377 @@ void CoalesceAllocator::destroyBuffer(Buffer*& buffer)
     }
     destroyBuffer(buffer->next);
     VirtualFree(static_cast<void*>(buffer), 0, MEM_RELEASE);
-}
\ No newline at end of file
+}
+
+void CoalesceAllocator::freeInBuffer(Buffer* buff, void* p)
+{
+    Block* current_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(p) - sizeof(Block)));
+    assert(!current_block->free && !current_block->quick && "CoalesceAllocator: invalid free");
+
+    // Medium blocks are parked unmerged in their exact size quick list and
+    // only coalesced once that list overflows.
+    if (use_quick_lists && current_block->size <= QUICK_LIST_MAX_SIZE) {
+        size_t index = quickIndex(current_block->size);
+        if (buff->quick_count[index] == QUICK_LIST_DEPTH) {
+            flushQuickList(buff, index);
+        }
+        *static_cast<size_t*>(p) = buff->quick_fh[index];
+        buff->quick_fh[index] = offsetOf(buff, current_block);
+        buff->quick_count[index]++;
+        buff->num_quick++;
+        current_block->quick = true;
+        return;
+    }
+
+    coalesceBlock(buff, current_block);
+}
+
+CoalesceAllocator::Block* CoalesceAllocator::coalesceBlock(Buffer* buff, Block* current_block)
+{
+    Block* next_block = nextBlock(buff, current_block);
+    if (next_block != nullptr && next_block->free) {
+        removeFree(buff, next_block);
+        current_block->size += next_block->size + sizeof(Block);
+    }
+
+    if (current_block->prev != INDEX_END_OF_LIST) {
+        Block* prev_block = blockAt(buff, current_block->prev);
+        if (prev_block->free) {
+            removeFree(buff, prev_block);
+            prev_block->size += current_block->size + sizeof(Block);
+            current_block = prev_block;
+        }
+    }
+
+    next_block = nextBlock(buff, current_block);
+    if (next_block != nullptr) {
+        next_block->prev = offsetOf(buff, current_block);
+    }
+
+    // A compaction cursor inside the merged block moves to its start.
+    if (buff == compact_buff) {
+        size_t offset = offsetOf(buff, current_block);
+        if (compact_offset > offset && compact_offset < offset + sizeof(Block) + current_block->size) {
+            compact_offset = offset;
+        }
+    }
+
+    insertFree(buff, current_block);
+    return current_block;
+}
+
+void CoalesceAllocator::flushQuickList(Buffer* buff, size_t index)
+{
+    size_t quick_index = buff->quick_fh[index];
+    while (quick_index != INDEX_END_OF_LIST) {
+        Block* current_block = blockAt(buff, quick_index);
+        quick_index = *static_cast<size_t*>(dataOf(current_block));
+        current_block->quick = false;
+        coalesceBlock(buff, current_block);
+    }
+    buff->num_quick -= buff->quick_count[index];
+    buff->quick_fh[index] = INDEX_END_OF_LIST;
+    buff->quick_count[index] = 0;
+}
+
+bool CoalesceAllocator::flushQuickLists(Buffer* buff)
+{
+    if (buff->num_quick == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < NUM_QUICK_LISTS; i++) {
+        if (buff->quick_count[i] != 0) {
+            flushQuickList(buff, i);
+        }
+    }
+    return true;
+}
+
+bool CoalesceAllocator::isMovable(const Block* block) const
+{
+    return !block->free && !block->quick && block->handle != INDEX_END_OF_LIST && handles[block->handle].pins == 0;
+}
+
+// Blocks parked in the quick lists are neither free nor movable, so the
+// quick lists of a buffer are merged when the cursor enters it.
+void CoalesceAllocator::startCompactPass(Buffer* buff, bool evacuate)
+{
+    compact_buff = buff;
+    compact_offset = 0;
+    compact_evacuate = evacuate;
+    flushQuickLists(buff);
+}
+
+// Moves block into the first earlier buffer with room. Returns the free
+// block left in its place, or nullptr when no earlier buffer has room.
+CoalesceAllocator::Block* CoalesceAllocator::evacuateBlock(Buffer* buff, Block* block)
+{
+    void* p = nullptr;
+    Buffer* target = buffer;
+    while (target != buff && p == nullptr) {
+        p = allocFromBuffer(target, block->size);
+        target = target->next;
+    }
+    if (p == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(p, dataOf(block), block->size);
+    static_cast<Block*>(static_cast<void*>(static_cast<char*>(p) - sizeof(Block)))->handle = block->handle;
+    handles[block->handle].p = p;
+
+    block->handle = INDEX_END_OF_LIST;
+    return coalesceBlock(buff, block);
+}
+
+// Swaps free_block with the busy block right after it: the data slides
+// down and the free space ends up behind it, merged with what follows.
+CoalesceAllocator::Block* CoalesceAllocator::moveDown(Buffer* buff, Block* free_block, Block* block)
+{
+    size_t free_size = free_block->size;
+    size_t free_prev = free_block->prev;
+    size_t size = block->size;
+    size_t handle = block->handle;
+
+    removeFree(buff, free_block);
+    memmove(dataOf(free_block), dataOf(block), size);
+
+    Block* moved_block = free_block;
+    moved_block->size = size;
+    moved_block->prev = free_prev;
+    moved_block->free = false;
+    moved_block->quick = false;
+    moved_block->handle = handle;
+    handles[handle].p = dataOf(moved_block);
+
+    Block* hole = static_cast<Block*>(static_cast<void*>(static_cast<char*>(dataOf(moved_block)) + size));
+    hole->size = free_size;
+    hole->prev = offsetOf(buff, moved_block);
+    hole->free = false;
+    hole->quick = false;
+    hole->handle = INDEX_END_OF_LIST;
+
+    Block* next_block = nextBlock(buff, hole);
+    if (next_block != nullptr) {
+        next_block->prev = offsetOf(buff, hole);
+    }
+    return coalesceBlock(buff, hole);
+}
+
+void CoalesceAllocator::releaseEmptyBuffers()
+{
+    if (is_fixed) {
+        return;
+    }
+
+    Buffer* prev_buff = buffer;
+    while (prev_buff->next != nullptr) {
+        Buffer* current_buff = prev_buff->next;
+        Block* first_block = blockAt(current_buff, 0);
+        if (current_buff->num_quick == 0 && first_block->free && first_block->size == buffer_size) {
+            if (current_buff == compact_buff) {
+                compact_buff = nullptr;
+            }
+            prev_buff->next = current_buff->next;
+            VirtualFree(static_cast<void*>(current_buff), 0, MEM_RELEASE);
+        }
+        else {
+            prev_buff = current_buff;
+        }
+    }
+}
+
+void* CoalesceAllocator::allocFromBuffer(Buffer* buff, size_t size)
+{
+    if (size <= QUICK_LIST_MAX_SIZE) {
+        size_t index = quickIndex(size);
+        if (buff->quick_fh[index] != INDEX_END_OF_LIST) {
+            Block* current_block = blockAt(buff, buff->quick_fh[index]);
+            buff->quick_fh[index] = *static_cast<size_t*>(dataOf(current_block));
+            buff->quick_count[index]--;
+            buff->num_quick--;
+            current_block->quick = false;
+            current_block->handle = INDEX_END_OF_LIST;
+            return dataOf(current_block);
+        }
+    }
+
+    Block* current_block = findFit(buff, size);
+    if (current_block == nullptr) {
+        // The parked blocks may merge into a fitting one.
+        if (!flushQuickLists(buff)) {
+            return nullptr;
+        }
+        current_block = findFit(buff, size);
+        if (current_block == nullptr) {
+            return nullptr;
+        }
+    }
+    removeFree(buff, current_block);
+
+    if (current_block->size >= size + sizeof(Block) + sizeof(FreeLinks)) {
+        Block* new_block = static_cast<Block*>(static_cast<void*>(static_cast<char*>(dataOf(current_block)) + size));
+        new_block->size = current_block->size - size - sizeof(Block);
+        new_block->prev = offsetOf(buff, current_block);
+        new_block->free = false;
+        new_block->quick = false;
+        new_block->handle = INDEX_END_OF_LIST;
+        current_block->size = size;
+
+        Block* next_block = nextBlock(buff, new_block);
+        if (next_block != nullptr) {
+            next_block->prev = offsetOf(buff, new_block);
+        }
+        insertFree(buff, new_block);
+    }
+
+    current_block->handle = INDEX_END_OF_LIST;
+    return dataOf(current_block);
+}
+
+CoalesceAllocator::Block* CoalesceAllocator::findFit(Buffer* buff, size_t size) const
+{
+    // Every block of the sub-lists from the one holding size rounded up to
+    // the next sub-list boundary fits, so the first non-empty one is found
+    // in constant time.
+    size_t own_index, own_sub_index;
+    listIndex(size, own_index, own_sub_index);
+    size_t index, sub_index;
+    if (own_index >= SUB_LISTS_LOG2) {
+        listIndex(size + (static_cast<size_t>(1) << (own_index - SUB_LISTS_LOG2)) - 1, index, sub_index);
+    }
+    else {
+        index = own_index + 1;
+        sub_index = 0;
+    }
+
+    unsigned long fit_index;
+    unsigned long fit_sub_index;
+    unsigned long long mask = index < NUM_FREE_LISTS ? buff->sub_lists_mask[index] & (~0ULL << sub_index) : 0;
+    if (mask != 0) {
+        _BitScanForward64(&fit_sub_index, mask);
+        return blockAt(buff, buff->fh[index][fit_sub_index]);
+    }
+    mask = index + 1 < NUM_FREE_LISTS ? buff->free_lists_mask & (~0ULL << (index + 1)) : 0;
+    if (mask != 0) {
+        _BitScanForward64(&fit_index, mask);
+        _BitScanForward64(&fit_sub_index, buff->sub_lists_mask[fit_index]);
+        return blockAt(buff, buff->fh[fit_index][fit_sub_index]);
+    }
+
+    // Blocks in the size's own sub-list may still fit. Its head is checked
+    // in constant time, scanning the rest is not bounded, so the real-time
+    // mode rather reports the failure.
+    size_t free_list_index = buff->fh[own_index][own_sub_index];
+    if (is_real_time && free_list_index != INDEX_END_OF_LIST) {
+        Block* current_block = blockAt(buff, free_list_index);
+        return current_block->size >= size ? current_block : nullptr;
+    }
+    while (free_list_index != INDEX_END_OF_LIST) {
+        Block* current_block = blockAt(buff, free_list_index);
+        if (current_block->size >= size) {
+            return current_block;
+        }
+        free_list_index = static_cast<FreeLinks*>(dataOf(current_block))->next;
+    }
+    return nullptr;
+}
+
+void CoalesceAllocator::insertFree(Buffer* buff, Block* block)
+{
+    size_t index, sub_index;
+    listIndex(block->size, index, sub_index);
+    size_t offset = offsetOf(buff, block);
+    FreeLinks* links = static_cast<FreeLinks*>(dataOf(block));
+
+    links->next = buff->fh[index][sub_index];
+    links->prev = INDEX_END_OF_LIST;
+    if (buff->fh[index][sub_index] != INDEX_END_OF_LIST) {
+        static_cast<FreeLinks*>(dataOf(blockAt(buff, buff->fh[index][sub_index])))->prev = offset;
+    }
+    buff->fh[index][sub_index] = offset;
+    buff->sub_lists_mask[index] |= 1ULL << sub_index;
+    buff->free_lists_mask |= 1ULL << index;
+    block->free = true;
+}
+
+void CoalesceAllocator::removeFree(Buffer* buff, Block* block)
+{
+    size_t index, sub_index;
+    listIndex(block->size, index, sub_index);
+    FreeLinks* links = static_cast<FreeLinks*>(dataOf(block));
+
+    if (links->prev == INDEX_END_OF_LIST) {
+        buff->fh[index][sub_index] = links->next;
+        if (links->next == INDEX_END_OF_LIST) {
+            buff->sub_lists_mask[index] &= ~(1ULL << sub_index);
+            if (buff->sub_lists_mask[index] == 0) {
+                buff->free_lists_mask &= ~(1ULL << index);
+            }
+        }
+    }
+    else {
+        static_cast<FreeLinks*>(dataOf(blockAt(buff, links->prev)))->next = links->next;
+    }
+    if (links->next != INDEX_END_OF_LIST) {
+        static_cast<FreeLinks*>(dataOf(blockAt(buff, links->next)))->prev = links->prev;
+    }
+    block->free = false;
+}
+
+void* CoalesceAllocator::blocksOf(const Buffer* buff)
+{
+    return const_cast<char*>(static_cast<const char*>(static_cast<const void*>(buff))) + headerSize();
+}
+
+void* CoalesceAllocator::dataOf(const Block* block)
+{
+    return const_cast<char*>(static_cast<const char*>(static_cast<const void*>(block))) + sizeof(Block);
+}
+
+CoalesceAllocator::Block* CoalesceAllocator::blockAt(const Buffer* buff, size_t offset) const
+{
+    return static_cast<Block*>(static_cast<void*>(static_cast<char*>(blocksOf(buff)) + offset));
+}
+
+size_t CoalesceAllocator::offsetOf(const Buffer* buff, const Block* block) const
+{
+    return static_cast<const char*>(static_cast<const void*>(block)) - static_cast<const char*>(blocksOf(buff));
+}
+
+CoalesceAllocator::Block* CoalesceAllocator::nextBlock(const Buffer* buff, const Block* block) const
+{
+    size_t offset = offsetOf(buff, block) + sizeof(Block) + block->size;
+    if (offset >= buffer_size + sizeof(Block)) {
+        return nullptr;
+    }
+    return blockAt(buff, offset);
+}
+
+bool CoalesceAllocator::owns(const Buffer* buff, const void* p) const
+{
+    return blocksOf(buff) < p && static_cast<const char*>(blocksOf(buff)) + buffer_size + sizeof(Block) > p;
+}
+
+size_t CoalesceAllocator::headerSize()
+{
+    return (sizeof(Buffer) + COALESCE_ALIGNMENT - 1) & ~static_cast<size_t>(COALESCE_ALIGNMENT - 1);
+}
+
+unsigned long long CoalesceAllocator::heapLayout()
+{
+    return static_cast<unsigned long long>(COALESCE_HEAP_VERSION) << 32 | sizeof(Buffer) << 16 | sizeof(Block);
+}
+
+size_t CoalesceAllocator::quickIndex(size_t size)
+{
+    return size / COALESCE_ALIGNMENT - 1;
+}
+
+void CoalesceAllocator::listIndex(size_t size, size_t& index, size_t& sub_index)
+{
+    unsigned long bit;
+    _BitScanReverse64(&bit, size);
+    index = bit;
+    sub_index = bit < SUB_LISTS_LOG2 ? 0 : (size >> (bit - SUB_LISTS_LOG2)) & (NUM_SUB_LISTS - 1);
+}
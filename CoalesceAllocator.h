@@ -1,12 +1,27 @@
 #pragma once
 #include <cassert>
 #include <windows.h>
+#include <intrin.h>
+#include <cstring>
+#include <vector>
+
+#include "OSMemory.h"
 
 #ifdef _DEBUG
 #include <iostream>
-#endif 
+#endif
 
 #define INDEX_END_OF_LIST -1
+#define NUM_FREE_LISTS 64
+#define SUB_LISTS_LOG2 3
+#define NUM_SUB_LISTS (1 << SUB_LISTS_LOG2)
+#define COALESCE_ALIGNMENT 16
+#define QUICK_LIST_MAX_SIZE 4096
+#define NUM_QUICK_LISTS (QUICK_LIST_MAX_SIZE / COALESCE_ALIGNMENT)
+#define QUICK_LIST_DEPTH 32
+#define COMPACT_VISITS_PER_MOVE 16
+#define COALESCE_HEAP_MAGIC 0x4845415043534543ULL
+#define COALESCE_HEAP_VERSION 3
 
 class CoalesceAllocator {
 public:
@@ -15,10 +30,63 @@ public:
 	virtual ~CoalesceAllocator();
 
 	virtual void init(size_t OSBlockSize);
+	// Real-time mode: the whole capacity is reserved and pre-faulted here,
+	// alloc never calls the OS and returns nullptr once the buffer is full.
+	// The fit is found in constant time: a request is served from the first
+	// free sub-list whose every block fits, or from the head of its own
+	// sub-list. Only the other blocks of its own sub-list, which are at most
+	// 1/NUM_SUB_LISTS of the power of two larger, are never considered.
+	// Quick lists are off, their flush on a miss has no constant bound.
+	virtual void initRealTime(size_t OSBlockSize);
+	// Shared mode: the buffer is created in (or opened from) the named shared
+	// memory segment, never grows, and alloc/free take a lock kept in the
+	// segment, so several processes may use it at once. Nothing inside the
+	// segment is an absolute address, processes exchange blocks with
+	// toOffset/fromOffset. openShared must follow the creator's initShared.
+	// Both return false when the segment can not be mapped, initShared also
+	// when a segment with that name already exists, openShared when it does
+	// not hold a heap.
+	virtual bool initShared(const char* name, size_t OSBlockSize);
+	virtual bool openShared(const char* name);
+	// Persistent mode: the buffer is mapped from the file at path and never
+	// grows. A heap left clean by flush or destroy with the same layout is
+	// resumed as is (resumed is set), anything else (no file, other size, a
+	// process that died after changes no flush covered) is formatted anew.
+	// Returns false when the file can not be mapped.
+	virtual bool initPersistent(const char* path, size_t OSBlockSize, bool& resumed);
+	// Checkpoint: writes the heap to disk and marks it clean. The next alloc,
+	// free, compact or setRoot clears the mark before changing the heap.
+	virtual void flush();
 	virtual void destroy();
 
 	virtual void* alloc(size_t size);
 	virtual bool free(void* p);
+	virtual bool owns(const void* p) const;
+
+	virtual size_t toOffset(const void* p) const;
+	virtual void* fromOffset(size_t offset) const;
+
+	// Handle based allocation: blocks allocated through a handle may be moved
+	// by compact while they are not pinned. pin returns the block's current
+	// address, valid until the matching unpin. Handles are local to the
+	// process, so they are not available in shared mode, and the blocks of a
+	// resumed persistent heap come back without handles.
+	virtual size_t allocHandle(size_t size);
+	virtual void* pin(size_t handle);
+	virtual void unpin(size_t handle);
+	virtual void freeHandle(size_t handle);
+	// Incremental compaction: continues where the previous call stopped,
+	// visits at most COMPACT_VISITS_PER_MOVE * max_moves blocks and moves at
+	// most max_moves unpinned handle blocks. A pass first slides the blocks
+	// down over the free space of their buffer, then moves the blocks of
+	// later buffers into earlier ones. Buffers left empty go back to the OS.
+	// Returns the number of blocks moved.
+	virtual size_t compact(size_t max_moves);
+
+	// Root object slot kept in the buffer header, so a resumed persistent
+	// heap (or another process of a shared one) can find its data.
+	virtual void setRoot(void* p);
+	virtual void* getRoot() const;
 
 #ifdef _DEBUG
 	virtual void dumpStat() const;
@@ -26,22 +94,101 @@ public:
 #endif
 
 private:
+	// Free blocks are kept in segregated lists, list i holds blocks with
+	// size in [2^i, 2^(i+1)), split into NUM_SUB_LISTS sub-lists of equal
+	// range. Bit i of free_lists_mask is set while list i has a non-empty
+	// sub-list, bit j of sub_lists_mask[i] while its sub-list j is not empty,
+	// so a fitting sub-list is found with two bit scans.
+	// Freed blocks up to QUICK_LIST_MAX_SIZE first wait unmerged in the
+	// quick list of their exact size (quick_fh, linked through the payload),
+	// so a hot size is reused without a split and merge.
+	// Blocks follow the header and are linked by offsets from the first one.
+	// layout identifies the version and header sizes a mapped heap was
+	// written with, so a heap of another build is never resumed.
 	struct Buffer {
 		Buffer* next;
-		size_t fh;
-		void* blocks;
+		unsigned long long magic;
+		unsigned long long layout;
+		size_t buffer_size;
+		size_t root;
+		volatile LONG lock;
+		LONG clean;
+		unsigned long long free_lists_mask;
+		unsigned long long sub_lists_mask[NUM_FREE_LISTS];
+		size_t fh[NUM_FREE_LISTS][NUM_SUB_LISTS];
+		size_t num_quick;
+		size_t quick_fh[NUM_QUICK_LISTS];
+		size_t quick_count[NUM_QUICK_LISTS];
 	};
-	struct Block {
+	// The payload follows the header.
+	struct alignas(COALESCE_ALIGNMENT) Block {
 		size_t size;
-		void* data;
+		size_t prev;
 		bool free;
+		bool quick;
+		size_t handle;
+	};
+	// Lives in the payload of a free block.
+	struct FreeLinks {
+		size_t next;
+		size_t prev;
+	};
+	// A free entry keeps the next free entry's index in pins.
+	struct HandleEntry {
+		void* p;
+		size_t pins;
 	};
 
+	void markDirty();
 	void allocBuffer(Buffer*& buffer);
+	Buffer* formatBuffer(void* buf);
 	void destroyBuffer(Buffer*& buffer);
 
+	void* allocFromBuffer(Buffer* buff, size_t size);
+	void freeInBuffer(Buffer* buff, void* p);
+	Block* coalesceBlock(Buffer* buff, Block* block);
+	void flushQuickList(Buffer* buff, size_t index);
+	bool flushQuickLists(Buffer* buff);
+
+	bool isMovable(const Block* block) const;
+	void startCompactPass(Buffer* buff, bool evacuate);
+	Block* evacuateBlock(Buffer* buff, Block* block);
+	Block* moveDown(Buffer* buff, Block* free_block, Block* block);
+	void releaseEmptyBuffers();
+	Block* findFit(Buffer* buff, size_t size) const;
+	void insertFree(Buffer* buff, Block* block);
+	void removeFree(Buffer* buff, Block* block);
+
+	Block* blockAt(const Buffer* buff, size_t offset) const;
+	size_t offsetOf(const Buffer* buff, const Block* block) const;
+	Block* nextBlock(const Buffer* buff, const Block* block) const;
+	bool owns(const Buffer* buff, const void* p) const;
+
+	static void* blocksOf(const Buffer* buff);
+	static void* dataOf(const Block* block);
+	static size_t headerSize();
+	static unsigned long long heapLayout();
+	static size_t quickIndex(size_t size);
+	static void listIndex(size_t size, size_t& index, size_t& sub_index);
+
     size_t buffer_size;
 	Buffer* buffer;
+	// is_fixed: the heap never grows, is_real_time: fits are found in
+	// bounded time, even at the cost of missing a fitting block.
+	bool is_fixed;
+	bool is_real_time;
+	bool use_quick_lists;
+	bool is_shared;
+	bool is_persistent;
+	HANDLE mapping;
+	HANDLE file;
+
+	std::vector<HandleEntry> handles;
+	size_t free_handle;
+	// Compaction cursor: the next block to visit and the pass it belongs to.
+	Buffer* compact_buff;
+	size_t compact_offset;
+	bool compact_evacuate;
 
 #ifdef _DEBUG
 	bool is_initialized;
@@ -49,5 +196,5 @@ private:
 
 	size_t num_alloc;
 	size_t num_free;
-#endif  
+#endif
 };
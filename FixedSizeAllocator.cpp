@@ -12,7 +12,7 @@ FixedSizeAllocator::FixedSizeAllocator() {
 
 FixedSizeAllocator::~FixedSizeAllocator() {
 #ifdef _DEBUG
-    assert(is_destroyed && "FSA: not destroyed before delete");
+    assert(!is_initialized && "FSA: not destroyed before delete");
 #endif 
 }
 
@@ -26,9 +26,137 @@ void FixedSizeAllocator::init(size_t block_size,size_t num_blocks_page) {
 
     this->block_size = block_size;
     this->num_blocks_page = num_blocks_page;
+    this->is_fixed = false;
+    this->is_shared = false;
+    this->is_persistent = false;
     allocPage(page);
 }
 
+void FixedSizeAllocator::initRealTime(size_t block_size, size_t num_blocks) {
+
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "FSA: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->block_size = block_size;
+    this->num_blocks_page = num_blocks;
+    this->is_fixed = true;
+    this->is_shared = false;
+    this->is_persistent = false;
+    allocPage(page);
+}
+
+bool FixedSizeAllocator::initShared(const char* name, size_t block_size, size_t num_blocks) {
+
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "FSA: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->block_size = block_size;
+    this->num_blocks_page = num_blocks;
+    this->is_fixed = true;
+    this->is_shared = true;
+    this->is_persistent = false;
+
+    void* buf = createSharedSegment(name, block_size * num_blocks_page + sizeof(Page), mapping);
+    if (buf == nullptr) {
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    page = formatPage(buf);
+    return true;
+}
+
+bool FixedSizeAllocator::openShared(const char* name) {
+
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "FSA: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->is_fixed = true;
+    this->is_shared = true;
+    this->is_persistent = false;
+
+    void* buf = openSharedSegment(name, mapping);
+    if (buf == nullptr) {
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    page = static_cast<Page*>(buf);
+    if (page->magic != FSA_HEAP_MAGIC || page->layout != pageLayout()) {
+        closeSharedSegment(buf, mapping);
+        page = nullptr;
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    this->block_size = page->block_size;
+    this->num_blocks_page = page->num_blocks;
+    return true;
+}
+
+bool FixedSizeAllocator::initPersistent(const char* path, size_t block_size, size_t num_blocks, bool& resumed) {
+
+#ifdef _DEBUG
+    is_initialized = true;
+    assert(!is_destroyed && "FSA: not destroyed before init");
+    is_destroyed = false;
+#endif 
+
+    this->block_size = block_size;
+    this->num_blocks_page = num_blocks;
+    this->is_fixed = true;
+    this->is_shared = false;
+    this->is_persistent = true;
+
+    bool existed;
+    void* buf = openFileSegment(path, block_size * num_blocks_page + sizeof(Page), file, mapping, existed);
+    if (buf == nullptr) {
+#ifdef _DEBUG
+        is_initialized = false;
+        is_destroyed = true;
+#endif 
+        return false;
+    }
+    page = static_cast<Page*>(buf);
+
+    resumed = existed && page->magic == FSA_HEAP_MAGIC && page->layout == pageLayout() && page->block_size == block_size && page->num_blocks == num_blocks && page->clean;
+    if (!resumed) {
+        formatPage(buf);
+        flush();
+    }
+    return true;
+}
+
+void FixedSizeAllocator::flush() {
+    assert(is_persistent && "FSA: flush of a non persistent heap");
+    // The blocks reach the disk before the mark, so a clean page is complete.
+    flushFileSegment(page, block_size * num_blocks_page + sizeof(Page), file);
+    page->clean = 1;
+    flushFileSegment(page, sizeof(Page), file);
+}
+
+void FixedSizeAllocator::markDirty() {
+    if (is_persistent && page->clean) {
+        page->clean = 0;
+        flushFileSegment(page, sizeof(Page), file);
+    }
+}
+
 void FixedSizeAllocator::destroy() {
 
 #ifdef _DEBUG
@@ -37,7 +165,16 @@ void FixedSizeAllocator::destroy() {
     is_initialized = false;
 #endif 
 
-    destroyPage(page);
+    if (is_shared) {
+        closeSharedSegment(page, mapping);
+    }
+    else if (is_persistent) {
+        flush();
+        closeFileSegment(page, mapping, file);
+    }
+    else {
+        destroyPage(page);
+    }
     page = nullptr;
 }
 
@@ -48,20 +185,39 @@ void* FixedSizeAllocator::alloc(size_t size) {
     num_alloc++;
 #endif 
 
+    markDirty();
+    if (is_shared) {
+        acquireSharedLock(&page->lock);
+        void* p = allocFromPage(page);
+        releaseSharedLock(&page->lock);
+#ifdef _DEBUG
+        if (p == nullptr) {
+            num_alloc--;
+        }
+#endif 
+        return p;
+    }
+
     Page* current_page = page;
 
     while (current_page->fh == INDEX_END_OF_LIST) {
         if (current_page->num_initialized < num_blocks_page) {
             current_page->num_initialized++;
-            void* p = static_cast<char*>(current_page->blocks) + (current_page->num_initialized - 1) * block_size;
+            void* p = static_cast<char*>(blocksOf(current_page)) + (current_page->num_initialized - 1) * block_size;
             return p;
         }
         if (current_page->next == nullptr) {
+            if (is_fixed) {
+#ifdef _DEBUG
+                num_alloc--;
+#endif 
+                return nullptr;
+            }
             allocPage(current_page->next);
         }
         current_page = current_page->next;
     }
-    void* p = static_cast<char*>(current_page->blocks) + current_page->fh * block_size;
+    void* p = static_cast<char*>(blocksOf(current_page)) + current_page->fh * block_size;
     current_page->fh = *static_cast<size_t*>(p);
     return p;
 }
@@ -73,11 +229,18 @@ bool FixedSizeAllocator::free(void* p) {
     num_free++;
 #endif
 
+    markDirty();
     Page* current_page = page;
     while (current_page != nullptr) {
-        if (static_cast<void*>(current_page->blocks) <= p && static_cast<void*>(static_cast<char*>(current_page->blocks) + num_blocks_page * block_size) > p) {
+        if (static_cast<void*>(blocksOf(current_page)) <= p && static_cast<void*>(static_cast<char*>(blocksOf(current_page)) + num_blocks_page * block_size) > p) {
+            if (is_shared) {
+                acquireSharedLock(&current_page->lock);
+            }
             *static_cast<size_t*>(p) = current_page->fh;
-            current_page->fh = static_cast<size_t>((static_cast<char*>(p) - static_cast<char*>(current_page->blocks))/block_size);
+            current_page->fh = static_cast<size_t>((static_cast<char*>(p) - static_cast<char*>(blocksOf(current_page)))/block_size);
+            if (is_shared) {
+                releaseSharedLock(&current_page->lock);
+            }
 
             return true;
         }
@@ -89,6 +252,23 @@ bool FixedSizeAllocator::free(void* p) {
     return false;
 }
 
+size_t FixedSizeAllocator::toOffset(const void* p) const {
+    return static_cast<const char*>(p) - static_cast<const char*>(static_cast<const void*>(page));
+}
+
+void* FixedSizeAllocator::fromOffset(size_t offset) const {
+    return static_cast<char*>(static_cast<void*>(page)) + offset;
+}
+
+void FixedSizeAllocator::setRoot(void* p) {
+    markDirty();
+    page->root = p == nullptr ? INDEX_END_OF_LIST : toOffset(p);
+}
+
+void* FixedSizeAllocator::getRoot() const {
+    return page->root == INDEX_END_OF_LIST ? nullptr : fromOffset(page->root);
+}
+
 #ifdef _DEBUG
 void FixedSizeAllocator::dumpStat() const {
 
@@ -113,7 +293,7 @@ void FixedSizeAllocator::dumpStat() const {
                     is_free = true;
                     break;
                 }
-                index = *static_cast<size_t*>(static_cast<void*>(static_cast<char*>(current_page->blocks) + index * block_size));
+                index = *static_cast<size_t*>(static_cast<void*>(static_cast<char*>(blocksOf(current_page)) + index * block_size));
             }
             if (!is_free) {
                 busy_blocks++;
@@ -160,7 +340,7 @@ void FixedSizeAllocator::dumpBlocks() const {
                     is_free = true;
                     break;
                 }
-                index = *static_cast<size_t*>(static_cast<void*>(static_cast<char*>(current_page->blocks) + index * block_size));
+                index = *static_cast<size_t*>(static_cast<void*>(static_cast<char*>(blocksOf(current_page)) + index * block_size));
             }
             std::cout << "\t\t\tBlock " << i;
 
@@ -171,7 +351,7 @@ void FixedSizeAllocator::dumpBlocks() const {
                 std::cout << " Free";
             }
 
-            std::cout << " Adress: " << static_cast<void*>(static_cast<char*>(current_page->blocks) + i * block_size) << std::endl;
+            std::cout << " Adress: " << static_cast<void*>(static_cast<char*>(blocksOf(current_page)) + i * block_size) << std::endl;
         }
 
         current_page = current_page->next;
@@ -183,11 +363,50 @@ void FixedSizeAllocator::dumpBlocks() const {
 void FixedSizeAllocator::allocPage(Page*& page) {
 
     void* buf = VirtualAlloc(NULL, block_size * num_blocks_page + sizeof(Page), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-    page = static_cast<Page*>(buf);
-    page->next = nullptr;
-    page->fh = INDEX_END_OF_LIST;
-    page->blocks = static_cast<char*>(buf) + sizeof(Page);
-    page->num_initialized = 0;
+    if (is_fixed) {
+        prefaultPages(buf, block_size * num_blocks_page + sizeof(Page));
+    }
+    page = formatPage(buf);
+}
+
+FixedSizeAllocator::Page* FixedSizeAllocator::formatPage(void* buf) {
+
+    Page* new_page = static_cast<Page*>(buf);
+    new_page->next = nullptr;
+    new_page->magic = FSA_HEAP_MAGIC;
+    new_page->layout = pageLayout();
+    new_page->fh = INDEX_END_OF_LIST;
+    new_page->num_initialized = 0;
+    new_page->block_size = block_size;
+    new_page->num_blocks = num_blocks_page;
+    new_page->root = INDEX_END_OF_LIST;
+    new_page->lock = 0;
+    new_page->clean = 0;
+    return new_page;
+}
+
+void* FixedSizeAllocator::allocFromPage(Page* page) {
+
+    if (page->fh != INDEX_END_OF_LIST) {
+        void* p = static_cast<char*>(blocksOf(page)) + page->fh * block_size;
+        page->fh = *static_cast<size_t*>(p);
+        return p;
+    }
+    if (page->num_initialized < num_blocks_page) {
+        page->num_initialized++;
+        return static_cast<char*>(blocksOf(page)) + (page->num_initialized - 1) * block_size;
+    }
+    return nullptr;
+}
+
+void* FixedSizeAllocator::blocksOf(const Page* page) {
+
+    return const_cast<char*>(static_cast<const char*>(static_cast<const void*>(page))) + sizeof(Page);
+}
+
+unsigned long long FixedSizeAllocator::pageLayout() {
+
+    return static_cast<unsigned long long>(FSA_HEAP_VERSION) << 32 | sizeof(Page);
 }
 
 void FixedSizeAllocator::destroyPage(Page*& page) {
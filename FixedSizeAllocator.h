@@ -3,11 +3,15 @@
 #include <cassert>
 #include <windows.h>
 
+#include "OSMemory.h"
+
 #ifdef _DEBUG
 #include <iostream>
 #endif 
 
 #define INDEX_END_OF_LIST -1
+#define FSA_HEAP_MAGIC 0x4845415046534150ULL
+#define FSA_HEAP_VERSION 2
 
 class FixedSizeAllocator {
 public:
@@ -15,11 +19,40 @@ public:
 	virtual ~FixedSizeAllocator();
 
 	virtual void init(size_t block_size, size_t num_blocks_page);
+	// Real-time mode: all num_blocks live in one pre-faulted page, alloc
+	// never calls the OS and returns nullptr once the page is full.
+	virtual void initRealTime(size_t block_size, size_t num_blocks);
+	// Shared mode: the single page of num_blocks is created in (or opened
+	// from) the named shared memory segment, alloc/free lock the page header
+	// and blocks are exchanged between processes with toOffset/fromOffset.
+	// openShared must follow the creator's initShared. Both return false
+	// when the segment can not be mapped, initShared also when a segment with
+	// that name already exists, openShared when it does not hold a page.
+	virtual bool initShared(const char* name, size_t block_size, size_t num_blocks);
+	virtual bool openShared(const char* name);
+	// Persistent mode: the single page of num_blocks is mapped from the file
+	// at path. A page left clean by flush or destroy with the same layout is
+	// resumed as is (resumed is set), anything else is formatted anew.
+	// Returns false when the file can not be mapped.
+	virtual bool initPersistent(const char* path, size_t block_size, size_t num_blocks, bool& resumed);
+	// Checkpoint: writes the page to disk and marks it clean. The next alloc,
+	// free or setRoot clears the mark before changing the page.
+	virtual void flush();
 	virtual void destroy();
 
 	virtual void* alloc(size_t size);
 	virtual bool free(void* p);
 
+	virtual size_t toOffset(const void* p) const;
+	virtual void* fromOffset(size_t offset) const;
+
+	// Bytes in front of the blocks of every page.
+	static size_t headerSize() { return sizeof(Page); }
+
+	// Root object slot kept in the page header.
+	virtual void setRoot(void* p);
+	virtual void* getRoot() const;
+
 #ifdef _DEBUG
 	virtual void dumpStat() const;
 	virtual void dumpBlocks() const;
@@ -34,17 +67,37 @@ private:
 	size_t num_free;
 #endif 
 
-	struct Page {
+	// Blocks follow the header, the free list links them by index. layout
+	// identifies the version and header size a mapped page was written with.
+	// The header keeps the blocks 16 byte aligned.
+	struct alignas(16) Page {
 		Page* next;
+		unsigned long long magic;
+		unsigned long long layout;
 		size_t fh; 
 		size_t num_initialized;
-		void* blocks;
+		size_t block_size;
+		size_t num_blocks;
+		size_t root;
+		volatile LONG lock;
+		LONG clean;
 	};
 
+    void markDirty();
     void allocPage(Page*& page);
+	Page* formatPage(void* buf);
+	static unsigned long long pageLayout();
 	void destroyPage(Page*& page);
 
+	void* allocFromPage(Page* page);
+	static void* blocksOf(const Page* page);
+
 	size_t block_size;
 	size_t num_blocks_page;
 	Page *page;
+	bool is_fixed;
+	bool is_shared;
+	bool is_persistent;
+	HANDLE mapping;
+	HANDLE file;
 };
@@ -0,0 +1,38 @@
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+void LatencyHistogram::reset() {
+	for (size_t i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+		buckets[i] = 0;
+	}
+	num_samples = 0;
+	max_cycles = 0;
+}
+
+void LatencyHistogram::record(unsigned long long cycles) {
+	unsigned long index;
+	_BitScanReverse64(&index, cycles | 1);
+	buckets[index]++;
+	num_samples++;
+	if (cycles > max_cycles) {
+		max_cycles = cycles;
+	}
+}
+
+unsigned long long LatencyHistogram::maxCycles() const {
+	return max_cycles;
+}
+
+void LatencyHistogram::dump(const char* name) const {
+	std::cout << "\t" << name << " latency:" << std::endl;
+	std::cout << "\t\tSamples: " << num_samples << " Max cycles: " << max_cycles << std::endl;
+	for (size_t i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+		if (buckets[i] == 0) {
+			continue;
+		}
+		std::cout << "\t\t[" << (1ULL << i) << ", " << (1ULL << i) * 2 << ") cycles: " << buckets[i] << std::endl;
+	}
+}
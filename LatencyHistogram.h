@@ -0,0 +1,22 @@
+#pragma once
+#include <intrin.h>
+#include <iostream>
+
+#define NUM_LATENCY_BUCKETS 64
+
+// Log2 histogram of rdtsc cycle counts, bucket i counts samples in [2^i, 2^(i+1)).
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void reset();
+	void record(unsigned long long cycles);
+
+	unsigned long long maxCycles() const;
+	void dump(const char* name) const;
+
+private:
+	unsigned long long buckets[NUM_LATENCY_BUCKETS];
+	unsigned long long num_samples;
+	unsigned long long max_cycles;
+};
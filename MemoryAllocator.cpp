@@ -8,6 +8,10 @@ MemoryAllocator::MemoryAllocator() {
 	num_alloc = 0;
 	num_free = 0;
 #endif 
+	is_real_time = false;
+	on_exhausted = nullptr;
+	profiler = nullptr;
+	num_fsa = 0;
 }
 
 MemoryAllocator::~MemoryAllocator() {
@@ -17,19 +21,48 @@ MemoryAllocator::~MemoryAllocator() {
 }
 
 void MemoryAllocator::init() {
+	init(defaultAllocatorConfig());
+}
+
+void MemoryAllocator::init(const AllocatorConfig& config) {
 #ifdef _DEBUG
 	is_initialized = true;
 	assert(!is_destroyed && "MemoryAllocator: not destroyed before init");
 	is_destroyed = false;
 #endif 
-	fsa16.init(16, 512);
-	fsa32.init(32, 256);
-	fsa64.init(64, 128);
-	fsa128.init(128, 64);
-	fsa256.init(256, 32);
-	fsa512.init(512, 16);
+	assert(config.num_classes <= MAX_FSA && "MemoryAllocator: too many size classes");
+
+	num_fsa = config.num_classes;
+	for (size_t i = 0; i < num_fsa; i++) {
+		fsa_size[i] = config.class_size[i];
+		fsa[i].init(config.class_size[i], config.blocks_per_page[i]);
+	}
+
+	coalesce_alloc.init(config.coalesce_size);
 
-	coalesce_alloc.init(SIZE * 2);
+	is_real_time = false;
+	on_exhausted = nullptr;
+}
+
+void MemoryAllocator::initRealTime(const RealTimeConfig& config) {
+#ifdef _DEBUG
+	is_initialized = true;
+	assert(!is_destroyed && "MemoryAllocator: not destroyed before init");
+	is_destroyed = false;
+#endif 
+	AllocatorConfig classes = defaultAllocatorConfig();
+	num_fsa = NUM_FSA;
+	for (size_t i = 0; i < num_fsa; i++) {
+		fsa_size[i] = classes.class_size[i];
+		fsa[i].initRealTime(classes.class_size[i], config.fsa_blocks[i]);
+	}
+
+	coalesce_alloc.initRealTime(config.coalesce_size);
+
+	is_real_time = true;
+	on_exhausted = config.on_exhausted;
+	alloc_latency.reset();
+	free_latency.reset();
 }
 void MemoryAllocator::destroy() {
 #ifdef _DEBUG
@@ -37,18 +70,16 @@ void MemoryAllocator::destroy() {
 	is_destroyed = true;
 	is_initialized = false;
 #endif 
-	fsa16.destroy();
-	fsa32.destroy();
-	fsa64.destroy();
-	fsa128.destroy();
-	fsa256.destroy();
-	fsa512.destroy();
+	for (size_t i = 0; i < num_fsa; i++) {
+		fsa[i].destroy();
+	}
 
 	coalesce_alloc.destroy();
 
 	for (size_t i = 0; i < OSBlocks.size(); i++) {
 		VirtualFree(OSBlocks[i].data, 0, MEM_RELEASE);
 	}
+	OSBlocks.clear();
 }
 
 void* MemoryAllocator::alloc(size_t size) {
@@ -57,33 +88,29 @@ void* MemoryAllocator::alloc(size_t size) {
 	num_alloc++;
 #endif 
 
-	if (size <= 16) {
-		return fsa16.alloc(size);
-	} 
-	if (size <= 32) {
-		return fsa32.alloc(size);
-	}
-	if (size <= 64) {
-		return fsa64.alloc(size);
-	}
-	if (size <= 128) {
-		return fsa128.alloc(size);
-	}
-	if (size <= 256) {
-		return fsa256.alloc(size);
-	}
-	if (size <= 512) {
-		return fsa512.alloc(size);
+	if (is_real_time) {
+		unsigned long long start = __rdtsc();
+		void* p = allocFromPools(size);
+		alloc_latency.record(__rdtsc() - start);
+
+		if (p == nullptr && on_exhausted != nullptr) {
+			on_exhausted(size);
+		}
+		return p;
 	}
-	if (size < SIZE) {
-		return coalesce_alloc.alloc(size);
+
+	void* p = allocFromPools(size);
+	if (p == nullptr) {
+		p = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		Block block;
+		block.data = p;
+		block.size = size;
+		OSBlocks.push_back(block);
 	}
-	void* p = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-	Block block;
-	block.data = p;
-	block.size = size;
-	OSBlocks.push_back(block);
 
+	if (profiler != nullptr) {
+		profiler->recordAlloc(size, p);
+	}
 	return p;
 }
 void MemoryAllocator::free(void* p) {
@@ -93,29 +120,98 @@ void MemoryAllocator::free(void* p) {
 	num_free++;
 #endif 
 
-	if (fsa16.free(p)) {
+	if (is_real_time) {
+		unsigned long long start = __rdtsc();
+		bool result = freeToPools(p);
+		free_latency.record(__rdtsc() - start);
+
+		assert(result && "Poiner out of bounds");
 		return;
 	}
-	if (fsa32.free(p)) {
-		return;
+
+	if (profiler != nullptr) {
+		profiler->recordFree(p);
 	}
-	if (fsa64.free(p)) {
+
+	if (freeToPools(p)) {
 		return;
 	}
-	if (fsa128.free(p)) {
+
+	freeOS(p);
+}
+void MemoryAllocator::free(void* p, size_t size) {
+
+#ifdef _DEBUG
+	assert(is_initialized && "MemoryAllocator: not initialized before free");
+	num_free++;
+#endif 
+
+	if (is_real_time) {
+		unsigned long long start = __rdtsc();
+		bool result = freeToPool(p, size);
+		free_latency.record(__rdtsc() - start);
+
+		assert(result && "Poiner out of bounds");
 		return;
 	}
-	if (fsa256.free(p)) {
-		return;
+
+	if (profiler != nullptr) {
+		profiler->recordFree(p);
 	}
-	if (fsa512.free(p)) {
+
+	// A coalescer smaller than size hands such blocks to the OS as well.
+	if (freeToPool(p, size)) {
 		return;
 	}
 
-	if (coalesce_alloc.free(p)) {
-		return;
+	freeOS(p);
+}
+
+void MemoryAllocator::setProfiler(AllocationProfiler* profiler) {
+	this->profiler = profiler;
+}
+
+void MemoryAllocator::dumpLatency() const {
+	std::cout << "Memory Allocator:" << std::endl;
+	alloc_latency.dump("Alloc");
+	free_latency.dump("Free");
+	std::cout << std::endl;
+}
+
+void* MemoryAllocator::allocFromPools(size_t size) {
+	for (size_t i = 0; i < num_fsa; i++) {
+		if (size <= fsa_size[i]) {
+			return fsa[i].alloc(size);
+		}
 	}
+	if (size < SIZE) {
+		return coalesce_alloc.alloc(size);
+	}
+	return nullptr;
+}
+
+bool MemoryAllocator::freeToPools(void* p) {
+	for (size_t i = 0; i < num_fsa; i++) {
+		if (fsa[i].free(p)) {
+			return true;
+		}
+	}
+	return coalesce_alloc.free(p);
+}
 
+bool MemoryAllocator::freeToPool(void* p, size_t size) {
+	for (size_t i = 0; i < num_fsa; i++) {
+		if (size <= fsa_size[i]) {
+			return fsa[i].free(p);
+		}
+	}
+	if (size < SIZE) {
+		return coalesce_alloc.free(p);
+	}
+	return false;
+}
+
+void MemoryAllocator::freeOS(void* p) {
 	bool result = VirtualFree(p, 0, MEM_RELEASE);
 	assert(result && "Poiner out of bounds");
 
@@ -136,12 +232,9 @@ void MemoryAllocator::dumpStat() const {
 	std::cout << "Memory Allocator:" << std::endl;
 	std::cout << "\tAllocs: " << num_alloc << " Frees: " << num_free << std::endl;
 
-	fsa16.dumpStat();
-	fsa32.dumpStat();
-	fsa64.dumpStat();
-	fsa128.dumpStat();
-	fsa256.dumpStat();
-	fsa512.dumpStat();
+	for (size_t i = 0; i < num_fsa; i++) {
+		fsa[i].dumpStat();
+	}
 
 	coalesce_alloc.dumpStat();
 
@@ -155,12 +248,9 @@ void MemoryAllocator::dumpBlocks() const {
 	assert(is_initialized && "MemoryAllocator: not initialized before dumpBlocks");
 
 	std::cout << "Memory Allocator:" << std::endl;
-	fsa16.dumpBlocks();
-	fsa32.dumpBlocks();
-	fsa64.dumpBlocks();
-	fsa128.dumpBlocks();
-	fsa256.dumpBlocks();
-	fsa512.dumpBlocks(); 
+	for (size_t i = 0; i < num_fsa; i++) {
+		fsa[i].dumpBlocks();
+	}
 
 	coalesce_alloc.dumpBlocks();
 
@@ -4,11 +4,23 @@
 
 #include "FixedSizeAllocator.h"
 #include "CoalesceAllocator.h"
+#include "LatencyHistogram.h"
+#include "AllocatorConfig.h"
+#include "AllocationProfiler.h"
 #include <iostream>
 #include <vector>
 
 
-#define SIZE 10485760
+#define NUM_FSA 6
+
+typedef void (*ExhaustionCallback)(size_t size);
+
+// Capacities reserved up front by initRealTime.
+struct RealTimeConfig {
+	size_t fsa_blocks[NUM_FSA]; // blocks for the default 16, 32, 64, 128, 256 and 512 byte classes
+	size_t coalesce_size;
+	ExhaustionCallback on_exhausted; // may be nullptr
+};
 
 class MemoryAllocator{
 public:
@@ -16,17 +28,37 @@ public:
 	virtual ~MemoryAllocator();
 
 	virtual void init();
+	// Sets up the size classes of config, e.g. one produced by AllocatorTune
+	// and read with loadAllocatorConfig.
+	virtual void init(const AllocatorConfig& config);
+	// Real-time mode: every pool is reserved and pre-faulted here, alloc and
+	// free never call the OS and take constant time. When a pool runs out
+	// alloc calls on_exhausted and returns nullptr instead of growing.
+	virtual void initRealTime(const RealTimeConfig& config);
 	virtual void destroy();
 
 	virtual void *alloc(size_t size);
 	virtual void free(void* p);
+	// size must be the one passed to alloc, it selects the pool directly
+	// instead of asking every pool whether it owns p.
+	virtual void free(void* p, size_t size);
 
 #ifdef _DEBUG
 	virtual void dumpStat() const;
 	virtual void dumpBlocks() const;
 #endif
+	virtual void dumpLatency() const;
+
+	// While set, every alloc and free outside the real-time mode is reported
+	// to profiler, whose data AllocatorTune turns into an AllocatorConfig.
+	virtual void setProfiler(AllocationProfiler* profiler);
 
 private:
+	void* allocFromPools(size_t size);
+	bool freeToPools(void* p);
+	bool freeToPool(void* p, size_t size);
+	void freeOS(void* p);
+
 	
 #ifdef _DEBUG
 	bool is_initialized;
@@ -43,12 +75,16 @@ private:
 
 	std::vector<Block> OSBlocks;
 
-	FixedSizeAllocator fsa16;
-    FixedSizeAllocator fsa32;
-    FixedSizeAllocator fsa64;
-    FixedSizeAllocator fsa128;
-    FixedSizeAllocator fsa256;
-    FixedSizeAllocator fsa512;
+	FixedSizeAllocator fsa[MAX_FSA];
+	size_t fsa_size[MAX_FSA];
+	size_t num_fsa;
 
 	CoalesceAllocator coalesce_alloc;
+
+	bool is_real_time;
+	ExhaustionCallback on_exhausted;
+	LatencyHistogram alloc_latency;
+	LatencyHistogram free_latency;
+
+	AllocationProfiler* profiler;
 };
@@ -0,0 +1,24 @@
+#include "MemoryResource.h"
+
+MemoryResource::MemoryResource(MemoryAllocator& allocator) : allocator(allocator) {
+}
+
+void* MemoryResource::do_allocate(size_t bytes, size_t alignment) {
+	if (alignment > MEMORY_RESOURCE_ALIGNMENT) {
+		throw std::bad_alloc();
+	}
+
+	void* p = allocator.alloc(bytes);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void MemoryResource::do_deallocate(void* p, size_t bytes, size_t) {
+	allocator.free(p, bytes);
+}
+
+bool MemoryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+	return this == &other;
+}
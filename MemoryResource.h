@@ -0,0 +1,23 @@
+#pragma once
+#include <memory_resource>
+#include <new>
+
+#include "MemoryAllocator.h"
+
+// Every FSA and coalescer block is aligned to this boundary.
+#define MEMORY_RESOURCE_ALIGNMENT 16
+
+// std::pmr::memory_resource over a MemoryAllocator, so pmr containers draw
+// from its pools. The allocator must stay initialized while in use.
+class MemoryResource : public std::pmr::memory_resource {
+public:
+	explicit MemoryResource(MemoryAllocator& allocator);
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+	MemoryAllocator& allocator;
+};
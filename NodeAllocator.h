@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+#include "FixedSizeAllocator.h"
+
+#define NODE_BLOCKS_PAGE 256
+// FixedSizeAllocator blocks follow a 16 byte aligned page header.
+#define NODE_MAX_ALIGNMENT 16
+
+// Stateless std::allocator replacement for node based containers
+// (std::list, std::map, std::unordered_map ...). Single objects come from a
+// FixedSizeAllocator dedicated to sizeof(T), so the nodes of every container
+// with the same node type share tightly packed pages. Arrays, such as hash
+// table buckets, and types aligned above NODE_MAX_ALIGNMENT go to the
+// global heap. The pool is shared by all threads, so its alloc and free are
+// serialized by a spin lock.
+template <class T>
+class NodeAllocator {
+public:
+	typedef T value_type;
+	typedef std::true_type is_always_equal;
+
+	NodeAllocator() noexcept {}
+	template <class U>
+	NodeAllocator(const NodeAllocator<U>&) noexcept {}
+
+	T* allocate(size_t n) {
+		if (alignof(T) > NODE_MAX_ALIGNMENT) {
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+		}
+		if (n == 1) {
+			acquireSharedLock(&poolLock());
+			void* p = pool().alloc(sizeof(T));
+			releaseSharedLock(&poolLock());
+			return static_cast<T*>(p);
+		}
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t n) {
+		if (alignof(T) > NODE_MAX_ALIGNMENT) {
+			::operator delete(p, std::align_val_t(alignof(T)));
+			return;
+		}
+		if (n == 1) {
+			acquireSharedLock(&poolLock());
+			pool().free(p);
+			releaseSharedLock(&poolLock());
+			return;
+		}
+		::operator delete(p);
+	}
+
+private:
+	// sizeof(T) is a multiple of alignof(T), so consecutive blocks stay aligned.
+	static const size_t BLOCK_SIZE = sizeof(T) > sizeof(size_t) ? sizeof(T) : sizeof(size_t);
+
+	// Created on first use and never destroyed, so containers with static
+	// storage duration can still release their nodes at exit.
+	static FixedSizeAllocator& pool() {
+		static FixedSizeAllocator* fsa = createPool();
+		return *fsa;
+	}
+
+	static volatile LONG& poolLock() {
+		static volatile LONG lock = 0;
+		return lock;
+	}
+
+	static FixedSizeAllocator* createPool() {
+		FixedSizeAllocator* fsa = new FixedSizeAllocator();
+		fsa->init(BLOCK_SIZE, NODE_BLOCKS_PAGE);
+		return fsa;
+	}
+};
+
+template <class T, class U>
+bool operator==(const NodeAllocator<T>&, const NodeAllocator<U>&) noexcept {
+	return true;
+}
+
+template <class T, class U>
+bool operator!=(const NodeAllocator<T>&, const NodeAllocator<U>&) noexcept {
+	return false;
+}
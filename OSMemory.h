@@ -0,0 +1,99 @@
+#pragma once
+#include <windows.h>
+
+#define OS_PAGE_SIZE 4096
+
+// Touches every OS page of [p, p + size) so that the page faults are taken
+// up front instead of on the first alloc that hands the memory out.
+inline void prefaultPages(void* p, size_t size) {
+	volatile char* current = static_cast<volatile char*>(p);
+	for (size_t offset = 0; offset < size; offset += OS_PAGE_SIZE) {
+		current[offset] = current[offset];
+	}
+}
+
+// Creates a named shared memory segment of size bytes and maps it, returns
+// nullptr on failure, including when a segment with that name already exists
+// (it may be a live heap). Other processes attach with openSharedSegment.
+inline void* createSharedSegment(const char* name, size_t size, HANDLE& mapping) {
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), name);
+	if (mapping == NULL) {
+		return nullptr;
+	}
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (base == NULL) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	return base;
+}
+
+inline void* openSharedSegment(const char* name, HANDLE& mapping) {
+	mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (mapping == NULL) {
+		return nullptr;
+	}
+	void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (base == NULL) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	return base;
+}
+
+inline void closeSharedSegment(void* base, HANDLE mapping) {
+	UnmapViewOfFile(base);
+	CloseHandle(mapping);
+}
+
+// Spin lock that works across processes as long as it lives in shared memory.
+inline void acquireSharedLock(volatile LONG* lock) {
+	while (InterlockedCompareExchange(lock, 1, 0) != 0) {
+		YieldProcessor();
+	}
+}
+
+inline void releaseSharedLock(volatile LONG* lock) {
+	InterlockedExchange(lock, 0);
+}
+
+// Opens (or creates) the file at path, grows it to size bytes and maps it,
+// returns nullptr on failure. existed tells whether the file was there before.
+inline void* openFileSegment(const char* path, size_t size, HANDLE& file, HANDLE& mapping, bool& existed) {
+	file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+	mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (base == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return nullptr;
+	}
+	return base;
+}
+
+// Writes [base, base + size) back to the file and waits until it is on disk.
+inline void flushFileSegment(void* base, size_t size, HANDLE file) {
+	FlushViewOfFile(base, size);
+	FlushFileBuffers(file);
+}
+
+inline void closeFileSegment(void* base, HANDLE mapping, HANDLE file) {
+	UnmapViewOfFile(base);
+	CloseHandle(mapping);
+	CloseHandle(file);
+}
@@ -0,0 +1,103 @@
+#include "SizeClassTuner.h"
+#include "FixedSizeAllocator.h"
+#include "OSMemory.h"
+
+static size_t roundUp(size_t size, size_t granularity) {
+	return (size + granularity - 1) / granularity * granularity;
+}
+
+// Peak bytes wasted when buckets [first, last] share the class of the last one.
+static unsigned long long classWaste(const AllocationProfiler& profile, size_t first, size_t last) {
+	unsigned long long waste = 0;
+	for (size_t i = first; i <= last; i++) {
+		waste += static_cast<unsigned long long>(profile.bucket(i).peak_live) * (last - i) * PROFILE_GRANULARITY;
+	}
+	return waste;
+}
+
+AllocatorConfig tuneAllocatorConfig(const AllocationProfiler& profile) {
+	AllocatorConfig config;
+	config.num_classes = 0;
+
+	size_t num_buckets = 0;
+	for (size_t i = 0; i < PROFILE_NUM_BUCKETS; i++) {
+		if (profile.bucket(i).count != 0) {
+			num_buckets = i + 1;
+		}
+	}
+
+	if (num_buckets != 0) {
+		// cost[k][i]: cheapest cover of buckets [0, i) by k classes, the last one ending at i - 1.
+		const unsigned long long NO_COVER = ~0ULL;
+		static unsigned long long cost[MAX_FSA + 1][PROFILE_NUM_BUCKETS + 1];
+		static size_t split[MAX_FSA + 1][PROFILE_NUM_BUCKETS + 1];
+
+		for (size_t k = 0; k <= MAX_FSA; k++) {
+			for (size_t i = 0; i <= num_buckets; i++) {
+				cost[k][i] = NO_COVER;
+			}
+		}
+		cost[0][0] = 0;
+
+		for (size_t k = 1; k <= MAX_FSA; k++) {
+			for (size_t i = 1; i <= num_buckets; i++) {
+				// Only sizes that occur are worth a class of their own.
+				if (profile.bucket(i - 1).count == 0 && i != num_buckets) {
+					continue;
+				}
+				for (size_t j = 0; j < i; j++) {
+					if (cost[k - 1][j] == NO_COVER) {
+						continue;
+					}
+					unsigned long long candidate = cost[k - 1][j] + classWaste(profile, j, i - 1) + TUNE_CLASS_COST;
+					if (candidate < cost[k][i]) {
+						cost[k][i] = candidate;
+						split[k][i] = j;
+					}
+				}
+			}
+		}
+
+		size_t best_k = 1;
+		for (size_t k = 1; k <= MAX_FSA; k++) {
+			if (cost[k][num_buckets] < cost[best_k][num_buckets]) {
+				best_k = k;
+			}
+		}
+
+		size_t ends[MAX_FSA];
+		size_t i = num_buckets;
+		for (size_t k = best_k; k > 0; k--) {
+			ends[k - 1] = i;
+			i = split[k][i];
+		}
+
+		size_t first = 0;
+		for (size_t k = 0; k < best_k; k++) {
+			size_t class_size = ends[k] * PROFILE_GRANULARITY;
+			size_t peak_live = 0;
+			for (size_t b = first; b < ends[k]; b++) {
+				peak_live += profile.bucket(b).peak_live;
+			}
+
+			size_t page_bytes = roundUp(peak_live * class_size + FixedSizeAllocator::headerSize(), OS_PAGE_SIZE);
+			if (page_bytes > TUNE_MAX_PAGE_BYTES) {
+				page_bytes = TUNE_MAX_PAGE_BYTES;
+			}
+			size_t blocks_per_page = (page_bytes - FixedSizeAllocator::headerSize()) / class_size;
+
+			config.class_size[k] = class_size;
+			config.blocks_per_page[k] = blocks_per_page > 0 ? blocks_per_page : 1;
+			first = ends[k];
+		}
+		config.num_classes = best_k;
+	}
+
+	size_t buffer_size = profile.medium().peak_live_bytes * 2;
+	if (buffer_size < profile.medium().max_size * 2) {
+		buffer_size = profile.medium().max_size * 2;
+	}
+	config.coalesce_size = roundUp(buffer_size > 0 ? buffer_size : 1, TUNE_BUFFER_GRANULARITY);
+
+	return config;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "AllocatorConfig.h"
+#include "AllocationProfiler.h"
+
+// Every extra class costs at least a partly used page.
+#define TUNE_CLASS_COST 4096
+#define TUNE_MAX_PAGE_BYTES 262144
+#define TUNE_BUFFER_GRANULARITY 1048576
+
+// Picks up to MAX_FSA class sizes covering every small size of profile so
+// that the internal fragmentation at peak (bytes between a request and its
+// class, times the peak live count) plus TUNE_CLASS_COST per class is
+// minimal. Pages are sized to hold a class's peak in one page where that
+// stays below TUNE_MAX_PAGE_BYTES, the coalescer buffer to twice the peak
+// of the medium sizes.
+AllocatorConfig tuneAllocatorConfig(const AllocationProfiler& profile);
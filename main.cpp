@@ -1,5 +1,11 @@
 #include <iostream>
 #include "MemoryAllocator.h"
+#include "AllocatorPolicies.h"
+#include "MemoryResource.h"
+#include "NodeAllocator.h"
+#include "SizeClassTuner.h"
+#include <list>
+#include <map>
 
 int main()
 {
@@ -45,6 +51,104 @@ int main()
     allocator.dumpStat();
 
     allocator.destroy();
+
+    RealTimeConfig config = { { 1024, 1024, 512, 256, 128, 64 }, SIZE, nullptr };
+    MemoryAllocator rt_allocator;
+    rt_allocator.initRealTime(config);
+
+    void* rt_blocks[64];
+    for (size_t i = 0; i < 64; i++) {
+        rt_blocks[i] = rt_allocator.alloc(8 << (i % 10));
+    }
+    for (size_t i = 0; i < 64; i++) {
+        rt_allocator.free(rt_blocks[i]);
+    }
+    rt_allocator.dumpLatency();
+
+    rt_allocator.destroy();
+
+    DefaultPolicyAllocator policy_allocator;
+    policy_allocator.init();
+    void* pPolicySmall = policy_allocator.alloc(sizeof(int));
+    void* pPolicyMedium = policy_allocator.alloc(sizeof(int) * 500);
+    void* pPolicyOS = policy_allocator.alloc(sizeof(int) * 10485760);
+    policy_allocator.free(pPolicySmall);
+    policy_allocator.free(pPolicyMedium);
+    policy_allocator.free(pPolicyOS);
+    policy_allocator.destroy();
+
+    MemoryAllocator pmr_allocator;
+    pmr_allocator.init();
+    {
+        MemoryResource resource(pmr_allocator);
+        std::pmr::vector<int> values(&resource);
+        for (int i = 0; i < 1000; i++) {
+            values.push_back(i);
+        }
+    }
+    pmr_allocator.dumpStat();
+    pmr_allocator.destroy();
+
+    std::list<int, NodeAllocator<int>> node_list;
+    std::map<int, int, std::less<int>, NodeAllocator<std::pair<const int, int>>> node_map;
+    for (int i = 0; i < 1000; i++) {
+        node_list.push_back(i);
+        node_map[i] = i;
+    }
+
+    CoalesceAllocator producer;
+    bool shared = producer.initShared("MemoryAllocatorMessages", SIZE);
+    assert(shared && "main: can not create shared heap");
+    CoalesceAllocator consumer;
+    shared = consumer.openShared("MemoryAllocatorMessages");
+    assert(shared && "main: can not open shared heap");
+
+    char* message = (char*)producer.alloc(4096);
+    message[0] = 'm';
+    size_t message_offset = producer.toOffset(message);
+    assert(*(char*)consumer.fromOffset(message_offset) == 'm');
+    consumer.free(consumer.fromOffset(message_offset));
+
+    consumer.destroy();
+    producer.destroy();
+
+    CoalesceAllocator movable_alloc;
+    movable_alloc.init(SIZE);
+    size_t h1 = movable_alloc.allocHandle(sizeof(int) * 500);
+    size_t h2 = movable_alloc.allocHandle(sizeof(int) * 500);
+    size_t h3 = movable_alloc.allocHandle(sizeof(int) * 500);
+    *(int*)movable_alloc.pin(h3) = 3;
+    movable_alloc.unpin(h3);
+    movable_alloc.freeHandle(h2);
+    movable_alloc.compact(16);
+    assert(*(int*)movable_alloc.pin(h3) == 3);
+    movable_alloc.unpin(h3);
+    movable_alloc.dumpBlocks();
+    movable_alloc.freeHandle(h1);
+    movable_alloc.freeHandle(h3);
+    movable_alloc.destroy();
+
+    AllocationProfiler profiler;
+    MemoryAllocator profiled_allocator;
+    profiled_allocator.init();
+    profiled_allocator.setProfiler(&profiler);
+    void* profiled_blocks[300];
+    for (size_t i = 0; i < 300; i++) {
+        profiled_blocks[i] = profiled_allocator.alloc(i % 3 == 0 ? 24 : (i % 3 == 1 ? 72 : 1500));
+    }
+    for (size_t i = 0; i < 300; i++) {
+        profiled_allocator.free(profiled_blocks[i]);
+    }
+    profiled_allocator.setProfiler(nullptr);
+    profiled_allocator.destroy();
+    profiler.dump();
+
+    AllocatorConfig tuned_config = tuneAllocatorConfig(profiler);
+    MemoryAllocator tuned_allocator;
+    tuned_allocator.init(tuned_config);
+    tuned_allocator.free(tuned_allocator.alloc(72));
+    tuned_allocator.dumpStat();
+    tuned_allocator.destroy();
     
     return 0;
 }